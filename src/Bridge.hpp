@@ -0,0 +1,363 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <map>
+
+#include <CGAL/box_intersection_d.h>
+
+#include "Polyhedron.hpp"
+
+
+
+/*
+* class for closing the gaps between adjacent buildings by local expansion only
+*
+* minkowski sum inflates every facet of every building, although only the regions where buildings nearly touch
+* need gap closing, the facet counts grow everywhere and the union becomes slow
+*
+* instead, a proximity query finds the (triangulated) faces of each building within the distance of another building,
+* only these patches are expanded: the minkowski sum of a triangle and the cube [0, size]^3 is the convex hull
+* of the triangle's vertices translated by the 8 cube corners, thus each patch becomes a small convex "bridge" solid
+* the originals are kept untouched and unioned with the bridges
+*
+* the proximity query:
+* (1) the pairs of triangles of different buildings whose bounding boxes (expanded by the distance) overlap
+*     are found with CGAL::box_intersection_d() over the whole block (a sweep, the cost grows with the pairs found,
+*     i.e. with the contact area, not with the total surface times the number of neighbours)
+* (2) vertex - triangle distances in both directions (exact for the parallel / coplanar party walls)
+* (3) each near triangle is clipped to the bounding box of the other triangle, only the clipped patch is bridged,
+*     thus a large party wall triangle only gets a bridge where the neighbour is
+*
+* the patches of one convex facet are merged into one bridge (the convex hull stays inside the facet),
+* the patches of a non-convex facet are merged per triangle
+*
+* since both buildings of a near-contact pair get bridges and the cube points in the same direction
+* for all buildings, the gap is closed from the side facing the positive direction (the same as the minkowski sum)
+*
+* usage:
+* Bridge bridge(distance);
+* bridge.build(jhandles, build_options, nefs); // instead of Build::build_nef_polyhedron() for each building
+* // no minkowski sum, union nefs (originals and bridges) directly
+*/
+class Bridge
+{
+public:
+
+	/*
+	* @param:
+	* distance: faces closer than this distance to another building are expanded, also the cube's side length
+	*/
+	Bridge(double distance = 0.01) : distance(distance) {}
+
+
+
+	/*
+	* build the original nefs and the bridge nefs of one block
+	*
+	* @param:
+	* jhandles: all buildings in one block
+	* options : see Build_options
+	* Nefs    : the originals and the bridges will be added to Nefs
+	*/
+	void build(const std::vector<JsonHandler>& jhandles, const Build_options& options, std::vector<Nef_polyhedron>& Nefs)
+	{
+		std::vector<Triangle_soup> soups;
+		for (const auto& jhandle : jhandles) {
+			Polyhedron_builder<Polyhedron::HalfedgeDS> polyhedron_builder;
+			if (!Build::get_polyhedron_builder(jhandle, polyhedron_builder, options))continue;
+
+			soups.emplace_back();
+			get_triangle_soup(polyhedron_builder, soups.back());
+
+			// the original
+			Build::build_nef_polyhedron(polyhedron_builder, jhandle.solids[0].id, Nefs, options);
+		}
+		std::size_t originals = Nefs.size();
+
+		// (1) candidate pairs: one box for each triangle of the block, info = (building, triangle)
+		std::vector<std::pair<std::size_t, std::size_t>> handles;
+		std::vector<Box> boxes;
+		for (std::size_t a = 0; a != soups.size(); ++a)
+			for (std::size_t s = 0; s != soups[a].triangles.size(); ++s) {
+				const Bbox& bbox = soups[a].bboxes[s];
+				boxes.emplace_back(CGAL::Bbox_3(bbox[0], bbox[1], bbox[2], bbox[3], bbox[4], bbox[5]), handles.size());
+				handles.emplace_back(a, s);
+			}
+
+		// (2) near triangles, (3) the patch of each near triangle next to the other triangle
+		// patches: (building, group) -> points, the group is the facet if it is convex, otherwise the triangle
+		std::map<std::pair<std::size_t, std::size_t>, std::vector<Point_3>> patches;
+		CGAL::box_intersection_d(boxes.begin(), boxes.end(), [this, &soups, &handles, &patches](const Box& x, const Box& y) {
+			std::size_t a = handles[x.info()].first, s = handles[x.info()].second;
+			std::size_t b = handles[y.info()].first, t = handles[y.info()].second;
+			if (a == b)return; // only bridge across buildings
+			if (!is_near(soups[a], s, soups[b], t))return;
+			add_patch(soups[a], s, soups[b].bboxes[t], patches[std::make_pair(a, group(soups[a], s))]);
+			add_patch(soups[b], t, soups[a].bboxes[s], patches[std::make_pair(b, group(soups[b], t))]);
+		});
+
+		// build the bridges
+		for (const auto& patch : patches) {
+			if (!patch.second.empty())add_bridge(patch.second, Nefs);
+		}
+
+		std::cout << "local expansion: " << originals << " originals, " << Nefs.size() - originals << " bridges\n";
+	}
+
+
+
+protected:
+
+	typedef std::vector<double> Bbox; // xmin, ymin, zmin, xmax, ymax, zmax, expanded by the distance
+	typedef CGAL::Box_intersection_d::Box_with_info_d<double, 3, std::size_t> Box; // info: index in the handles
+
+	/*
+	* triangulated surface of one building, with the bounding boxes for the proximity query
+	*/
+	struct Triangle_soup
+	{
+		std::vector<Point_3> vertices;
+		std::vector<std::vector<unsigned long>> triangles;
+		std::vector<Bbox> bboxes; // one bounding box for each triangle
+		std::vector<std::size_t> facets; // the face of each triangle
+		std::vector<bool> convex; // for each face
+	};
+
+
+
+	/*
+	* triangulate the faces of a building (see Build::triangulate_face_with_holes()) and get the bounding boxes
+	*/
+	void get_triangle_soup(const Polyhedron_builder<Polyhedron::HalfedgeDS>& polyhedron_builder, Triangle_soup& soup) const
+	{
+		soup.vertices = polyhedron_builder.vertices;
+		for (const auto& indices : polyhedron_builder.faces) {
+			if (indices.size() < 3)continue;
+			std::size_t facet = soup.convex.size();
+			soup.convex.push_back(is_convex(soup.vertices, indices));
+
+			std::vector<std::vector<unsigned long>> triangles;
+			if (indices.size() == 3) {
+				triangles.push_back(indices);
+			}
+			else {
+				Face face;
+				face.rings.emplace_back();
+				face.rings.back().indices = indices;
+				if (!Build::triangulate_face_with_holes(soup.vertices, face, triangles)) {
+					triangles.clear();
+					for (std::size_t i = 1; i + 1 < indices.size(); ++i) { // fan, for the proximity query only
+						triangles.push_back({ indices[0], indices[i], indices[i + 1] });
+					}
+					soup.convex.back() = false; // the fan may leave the face, bridge each triangle on its own
+				}
+			}
+			soup.triangles.insert(soup.triangles.end(), triangles.begin(), triangles.end());
+			soup.facets.insert(soup.facets.end(), triangles.size(), facet);
+		}
+
+		for (const auto& triangle : soup.triangles) {
+			Bbox bbox = empty_bbox();
+			for (auto index : triangle) {
+				double c[3] = { to_double(soup.vertices[index], 0), to_double(soup.vertices[index], 1), to_double(soup.vertices[index], 2) };
+				for (int i = 0; i != 3; ++i) {
+					bbox[i] = std::min(bbox[i], c[i] - distance);
+					bbox[i + 3] = std::max(bbox[i + 3], c[i] + distance);
+				}
+			}
+			soup.bboxes.emplace_back(bbox);
+		}
+	}
+
+
+
+	/*
+	* whether a (planar) face is convex: all turns have the same sign along the normal (Newell, inexact)
+	*/
+	static bool is_convex(const std::vector<Point_3>& vertices, const std::vector<unsigned long>& indices)
+	{
+		if (indices.size() == 3)return true;
+
+		std::size_t n = indices.size();
+		double normal[3] = { 0, 0, 0 };
+		for (std::size_t i = 0; i != n; ++i) {
+			const Point_3& p = vertices[indices[i]];
+			const Point_3& q = vertices[indices[(i + 1) % n]];
+			for (int k = 0; k != 3; ++k) {
+				int k1 = (k + 1) % 3, k2 = (k + 2) % 3;
+				normal[k] += (to_double(p, k1) - to_double(q, k1)) * (to_double(p, k2) + to_double(q, k2));
+			}
+		}
+
+		for (std::size_t i = 0; i != n; ++i) {
+			double u[3], w[3];
+			for (int k = 0; k != 3; ++k) {
+				u[k] = to_double(vertices[indices[(i + 1) % n]], k) - to_double(vertices[indices[i]], k);
+				w[k] = to_double(vertices[indices[(i + 2) % n]], k) - to_double(vertices[indices[(i + 1) % n]], k);
+			}
+			double turn =
+				(u[1] * w[2] - u[2] * w[1]) * normal[0] +
+				(u[2] * w[0] - u[0] * w[2]) * normal[1] +
+				(u[0] * w[1] - u[1] * w[0]) * normal[2];
+			if (turn < 0)return false;
+		}
+		return true;
+	}
+
+
+
+	/*
+	* the group of a triangle for merging the patches: its facet if convex, otherwise the triangle itself
+	*/
+	static std::size_t group(const Triangle_soup& soup, std::size_t t)
+	{
+		std::size_t facet = soup.facets[t];
+		return soup.convex[facet] ? facet : soup.convex.size() + t;
+	}
+
+
+
+	/*
+	* clip a triangle to a bounding box (Sutherland - Hodgman, exact) and add the vertices of the patch to points
+	* the box is the (expanded) box of the other triangle: every point of the triangle within the distance of it is kept
+	*/
+	static void add_patch(const Triangle_soup& soup, std::size_t t, const Bbox& bbox, std::vector<Point_3>& points)
+	{
+		std::vector<Point_3> polygon;
+		for (auto index : soup.triangles[t])polygon.push_back(soup.vertices[index]);
+
+		for (int side = 0; side != 6 && !polygon.empty(); ++side) {
+			int axis = side % 3;
+			Kernel::FT bound(bbox[side]);
+			bool lower = side < 3; // keep p[axis] >= bound for the lower sides, p[axis] <= bound for the upper sides
+			auto inside = [axis, &bound, lower](const Point_3& p) { return lower ? p[axis] >= bound : p[axis] <= bound; };
+
+			std::vector<Point_3> clipped;
+			for (std::size_t i = 0; i != polygon.size(); ++i) {
+				const Point_3& p = polygon[i];
+				const Point_3& q = polygon[(i + 1) % polygon.size()];
+				if (inside(p))clipped.push_back(p);
+				if (inside(p) != inside(q)) { // the edge crosses the side
+					Kernel::FT ratio = (bound - p[axis]) / (q[axis] - p[axis]);
+					clipped.push_back(p + (q - p) * ratio);
+				}
+			}
+			polygon.swap(clipped);
+		}
+		points.insert(points.end(), polygon.begin(), polygon.end());
+	}
+
+
+
+	/*
+	* whether two triangles are within the distance
+	* the minimum of the vertex - triangle distances in both directions
+	*/
+	bool is_near(const Triangle_soup& sa, std::size_t s, const Triangle_soup& sb, std::size_t t) const
+	{
+		for (auto index : sa.triangles[s]) {
+			if (squared_distance(sa.vertices[index], sb, t) <= distance * distance)return true;
+		}
+		for (auto index : sb.triangles[t]) {
+			if (squared_distance(sb.vertices[index], sa, s) <= distance * distance)return true;
+		}
+		return false;
+	}
+
+
+
+	/*
+	* squared distance from a point to a triangle (inexact, for the proximity query only)
+	* closest point on the triangle via the voronoi regions of its vertices, edges and face
+	*/
+	static double squared_distance(const Point_3& point, const Triangle_soup& soup, std::size_t t)
+	{
+		const auto& triangle = soup.triangles[t];
+		double p[3], a[3], b[3], c[3];
+		for (int i = 0; i != 3; ++i) {
+			p[i] = to_double(point, i);
+			a[i] = to_double(soup.vertices[triangle[0]], i);
+			b[i] = to_double(soup.vertices[triangle[1]], i);
+			c[i] = to_double(soup.vertices[triangle[2]], i);
+		}
+
+		double ab[3], ac[3], ap[3], bp[3], cp[3];
+		for (int i = 0; i != 3; ++i) {
+			ab[i] = b[i] - a[i]; ac[i] = c[i] - a[i];
+			ap[i] = p[i] - a[i]; bp[i] = p[i] - b[i]; cp[i] = p[i] - c[i];
+		}
+		auto dot = [](const double u[3], const double w[3]) { return u[0] * w[0] + u[1] * w[1] + u[2] * w[2]; };
+
+		double q[3]; // closest point
+		auto at = [&q, &a, &ab, &ac](double v, double w) {
+			for (int i = 0; i != 3; ++i)q[i] = a[i] + v * ab[i] + w * ac[i];
+		};
+
+		double d1 = dot(ab, ap), d2 = dot(ac, ap);
+		double d3 = dot(ab, bp), d4 = dot(ac, bp);
+		double d5 = dot(ab, cp), d6 = dot(ac, cp);
+		double va = d3 * d6 - d5 * d4, vb = d5 * d2 - d1 * d6, vc = d1 * d4 - d3 * d2;
+
+		if (d1 <= 0 && d2 <= 0)at(0, 0); // vertex a
+		else if (d3 >= 0 && d4 <= d3)at(1, 0); // vertex b
+		else if (d6 >= 0 && d5 <= d6)at(0, 1); // vertex c
+		else if (vc <= 0 && d1 >= 0 && d3 <= 0)at(d1 / (d1 - d3), 0); // edge ab
+		else if (vb <= 0 && d2 >= 0 && d6 <= 0)at(0, d2 / (d2 - d6)); // edge ac
+		else if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0) { // edge bc
+			double w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+			at(1 - w, w);
+		}
+		else { // face
+			double denom = va + vb + vc;
+			if (std::abs(denom) < epsilon)at(0, 0); // degenerate triangle
+			else at(vb / denom, vc / denom);
+		}
+
+		double squared = 0;
+		for (int i = 0; i != 3; ++i)squared += (p[i] - q[i]) * (p[i] - q[i]);
+		return squared;
+	}
+
+
+
+	/*
+	* add the bridge of one patch: convex hull of the patch's vertices translated by the cube corners
+	*/
+	void add_bridge(const std::vector<Point_3>& patch, std::vector<Nef_polyhedron>& Nefs) const
+	{
+		std::vector<Point_3> points;
+		points.reserve(patch.size() * 8);
+		for (const auto& p : patch)
+			for (int corner = 0; corner != 8; ++corner) {
+				Kernel::Vector_3 offset(
+					(corner & 1) ? distance : 0,
+					(corner & 2) ? distance : 0,
+					(corner & 4) ? distance : 0);
+				points.push_back(p + offset);
+			}
+
+		Polyhedron hull;
+		CGAL::convex_hull_3(points.begin(), points.end(), hull);
+		if (hull.is_closed())Nefs.emplace_back(hull);
+	}
+
+
+
+	static Bbox empty_bbox()
+	{
+		double inf = std::numeric_limits<double>::max();
+		return Bbox{ inf, inf, inf, -inf, -inf, -inf };
+	}
+
+	static double to_double(const Point_3& p, int i)
+	{
+		return CGAL::to_double(p[i]);
+	}
+
+
+
+protected:
+
+	double distance;
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <functional> // for std::function
+#include <memory> // for std::shared_ptr
+#include <future> // for std::promise
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+
+#include "Polyhedron.hpp"
+#include "Workers.hpp"
+
+
+
+/*
+* namespace Budget -> wall-clock budget for the tasks on a single building
+*
+* minkowski_sum_3 of a single building can run effectively forever (e.g. dataset_2)
+* and CGAL can not be interrupted from outside, thus a task under a budget is run where it can be stopped:
+*
+* POSIX : the task runs in a worker process (see Workers, started before the threads), the nefs are passed over a socket,
+*         a worker exceeding the budget is killed (SIGKILL) and replaced
+* others: the task runs in a detached thread on its own copy of the nef (passed as a string),
+*         a thread exceeding the budget is abandoned (it keeps running until it finishes or the program exits)
+*
+* a task exceeding its budget is replaced by a cheaper approximation by the caller (see MT::expand_nef_within_budget())
+* and the replacement is logged, the log can be written to a file after processing
+*
+* with isolate set (POSIX only) every task runs in a worker process, also without a budget:
+* a segfault inside CGAL only kills the worker (CRASHED), the caller retries it (retries) or replaces it
+* a task without budget is still killed after hang_limit seconds
+*/
+namespace Budget {
+
+
+enum class Status { SUCCESS, FAILED, TIMED_OUT, CRASHED };
+
+
+/*
+* one record of the log
+* object     : which object is replaced, e.g. the key of the nef
+* reason     : "timed out" or "failed"
+* replacement: what is used instead, e.g. "hull"
+*/
+struct Entry
+{
+  std::string object;
+  std::string reason;
+  std::string replacement;
+};
+
+
+double seconds = 0; // budget of each task, 0 -> no budget
+bool isolate = false; // run every task in a worker process, also without budget
+double hang_limit = 3600; // seconds, a task in a worker process without budget is killed after this
+unsigned retries = 1; // number of times a crashed task is tried again by the caller
+std::vector<Entry> replacements; // log of the replaced tasks
+std::mutex log_mutex; // for thread-safety, tasks can be run in multi threading process
+
+
+
+/*
+* get the string of a status, for prompting info
+*/
+std::string status_string(Status status)
+{
+  switch (status) {
+  case Status::SUCCESS: return "success";
+  case Status::TIMED_OUT: return "timed out";
+  case Status::CRASHED: return "crashed";
+  default: return "failed";
+  }
+}
+
+
+
+/*
+* run a task within the budget
+*
+* @param:
+* job   : the task, registered with Workers::add_job() (it can not capture anything, the input is passed as nef and params)
+* nef   : the input nef
+* params: the parameters of the job
+* budget: seconds, 0 -> without budget (in this thread, or in a worker process with hang_limit if isolate)
+* result: the result nef of the task
+* @return:
+* the status of the task, result is only set if SUCCESS
+* CRASHED if the worker process died (e.g. segfault)
+*/
+Status run(int job, const Nef_polyhedron& nef, const std::vector<double>& params, double budget, Nef_polyhedron& result)
+{
+  const Workers::Job& task = Workers::get_jobs()[job];
+  bool helper = budget > 0 || isolate;
+
+  // worker process, killed when the budget is used up
+  if (helper && Workers::started()) {
+	switch (Workers::run(job, nef, params, budget > 0 ? budget : hang_limit, result)) {
+	case Workers::Result::SUCCESS: return Status::SUCCESS;
+	case Workers::Result::TIMED_OUT: return Status::TIMED_OUT;
+	case Workers::Result::CRASHED: return Status::CRASHED;
+	default: return Status::FAILED;
+	}
+  }
+
+  // no budget (or no worker processes without budget), run in this thread
+  if (budget <= 0) {
+	try {
+	  return task(nef, params, result) ? Status::SUCCESS : Status::FAILED;
+	}
+	catch (...) {
+	  return Status::FAILED;
+	}
+  }
+
+  // run in a detached thread and stop waiting when the budget is used up
+  // the promise is shared so that an abandoned thread still has a valid place for its result
+  // a copied nef shares its representation (and minkowski_sum_3 decomposes it in place),
+  // thus the nefs are passed as strings: an abandoned thread never touches a nef of the caller
+  std::ostringstream out;
+  out << nef;
+  typedef std::pair<bool, std::string> Result;
+  auto promise = std::make_shared<std::promise<Result>>();
+  std::future<Result> future = promise->get_future();
+
+  std::thread([promise, task, input = out.str(), params]() {
+	try {
+	  Nef_polyhedron thread_nef;
+	  std::istringstream in(input);
+	  in >> thread_nef;
+	  Nef_polyhedron thread_result;
+	  bool ok = task(thread_nef, params, thread_result);
+	  std::ostringstream thread_out;
+	  if (ok)thread_out << thread_result;
+	  promise->set_value(Result(ok, thread_out.str()));
+	}
+	catch (...) {
+	  promise->set_value(Result(false, std::string()));
+	}
+  }).detach();
+
+  if (future.wait_for(std::chrono::duration<double>(budget)) == std::future_status::timeout) {
+	return Status::TIMED_OUT;
+  }
+
+  Result thread_result = future.get();
+  if (!thread_result.first)return Status::FAILED;
+  std::istringstream in(thread_result.second);
+  in >> result;
+  return Status::SUCCESS;
+}
+
+
+
+/*
+* add a replacement to the log
+*/
+void log(const std::string& object, Status status, const std::string& replacement)
+{
+  std::cout << "budget: " << object << " " << status_string(status) << ", replaced by " << replacement << '\n';
+  std::lock_guard<std::mutex> lock(log_mutex);
+  replacements.push_back({ object, status_string(status), replacement });
+}
+
+
+
+/*
+* write the log to a txt file, one replacement per line:
+* object	reason	replacement
+* return true if successful otherwise false
+*/
+bool write_log(const std::string& filename)
+{
+  std::ofstream out(filename);
+  if (!out.is_open()) {
+	std::cerr << "Error: Unable to open budget log \"" << filename << "\" for writing!" << std::endl;
+	return false;
+  }
+
+  std::lock_guard<std::mutex> lock(log_mutex);
+  for (const auto& entry : replacements) {
+	out << entry.object << '\t' << entry.reason << '\t' << entry.replacement << '\n';
+  }
+  std::cout << "budget: " << replacements.size() << " tasks replaced\n";
+  std::cout << "log saved at: " << filename << '\n';
+  return true;
+}
+
+
+};
@@ -0,0 +1,297 @@
+#pragma once
+
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <numeric> // for std::iota
+#include <algorithm>
+
+#include "Polyhedron.hpp"
+#include "ThreadPool.hpp"
+
+
+
+/*
+* namespace Cost -> cost model for minkowski sum tasks
+*
+* the run time of minkowski sum varies by orders of magnitude between a box house and a complex LoD2.2 building
+* minkowski_sum_3 decomposes the nef into convex pieces (about one cut per reflex edge)
+* and sums / unions each piece with the cube, thus the cost is modelled as:
+*
+* seconds = c0 + c1 * vertices + c2 * facets + c3 * reflex_edges * facets
+*
+* the coefficients are calibrated (least squares) from the recorded timings of previous runs,
+* default coefficients are used if there are not enough records
+*
+* the predicted costs are used to schedule the tasks longest-first
+* so that an expensive building is not started last and does not stretch the wall time of the block
+*
+* usage:
+* Cost::read_records(file);                   // optional, calibrates the model
+* order = Cost::schedule(nefs, features, &pool); // longest-first order of the nefs, prints the predicted time
+* Cost::record(features[i], seconds);         // after each task
+* Cost::write_records(file);                  // optional
+*/
+namespace Cost {
+
+
+/*
+* features of one nef
+*/
+struct Features
+{
+  double vertices = 0;
+  double facets = 0;
+  double reflex_edges = 0;
+};
+
+
+bool enabled = false; // schedule and record the minkowski tasks
+const std::size_t number_of_coefficients = 4;
+std::vector<double> coefficients = { 0.05, 1e-4, 1e-3, 2e-5 }; // default: rough values for minkowski_sum_3 with the cube
+std::size_t min_records = 20; // calibrate only with at least this many records
+std::size_t max_records = 10000; // only the most recent records are written (sliding window)
+
+std::vector<std::pair<Features, double>> records; // (features, seconds)
+std::mutex records_mutex; // for thread-safety, tasks can be recorded in multi threading process
+
+
+
+/*
+* terms of the model for the given features
+*/
+std::vector<double> get_terms(const Features& features)
+{
+  return { 1.0, features.vertices, features.facets, features.reflex_edges * features.facets };
+}
+
+
+
+/*
+* normal of a facet (Newell's method, exact)
+* the facets of a nef are maximal and can be non-convex (e.g. an L-shaped roof),
+* the normal of three consecutive vertices flips at a reflex corner, the sum over all edges does not
+*/
+template <class Facet_handle>
+Kernel::Vector_3 get_normal(Facet_handle facet)
+{
+  Kernel::Vector_3 normal(0, 0, 0);
+  auto h = facet->facet_begin();
+  do {
+	Kernel::Vector_3 p = h->vertex()->point() - CGAL::ORIGIN;
+	Kernel::Vector_3 q = h->next()->vertex()->point() - CGAL::ORIGIN;
+	normal = normal + CGAL::cross_product(p, q);
+  } while (++h != facet->facet_begin());
+  return normal;
+}
+
+
+
+/*
+* get the features of a nef
+* the reflex edges are counted on the polyhedron converted from the nef (exact predicates),
+* the normal of each facet is computed once
+* for a non-simple nef the reflex edges are not counted
+*/
+Features get_features(const Nef_polyhedron& nef)
+{
+  Features features;
+  features.vertices = (double)nef.number_of_vertices();
+  features.facets = (double)nef.number_of_facets();
+
+  if (!nef.is_simple())return features;
+
+  Polyhedron polyhedron;
+  nef.convert_to_polyhedron(polyhedron);
+
+  std::map<const void*, Kernel::Vector_3> normals; // facet -> normal
+  for (auto f = polyhedron.facets_begin(); f != polyhedron.facets_end(); ++f) {
+	normals.emplace(&*f, get_normal(f));
+  }
+
+  // an edge u -> v of facet f1 with the opposite facet f2 is reflex if (n1 x n2) . (v - u) < 0 (outward normals)
+  std::size_t reflex = 0;
+  for (auto h = polyhedron.edges_begin(); h != polyhedron.edges_end(); ++h) { // each edge once
+	if (h->is_border() || h->opposite()->is_border())continue;
+
+	const Kernel::Vector_3& n1 = normals[&*h->facet()];
+	const Kernel::Vector_3& n2 = normals[&*h->opposite()->facet()];
+	Kernel::Vector_3 edge = h->vertex()->point() - h->opposite()->vertex()->point();
+	if (CGAL::cross_product(n1, n2) * edge < 0)++reflex;
+  }
+  features.reflex_edges = (double)reflex;
+
+  return features;
+}
+
+
+
+/*
+* predicted seconds for the given features
+*/
+double predict(const Features& features)
+{
+  std::vector<double> terms = get_terms(features);
+  double seconds = 0;
+  for (std::size_t i = 0; i != number_of_coefficients; ++i)seconds += coefficients[i] * terms[i];
+  return std::max(seconds, 0.0);
+}
+
+
+
+/*
+* add a timing to the records
+*/
+void record(const Features& features, double seconds)
+{
+  std::lock_guard<std::mutex> lock(records_mutex);
+  records.emplace_back(features, seconds);
+}
+
+
+
+/*
+* calibrate the coefficients from the records (least squares, normal equations)
+* return false if there are not enough records or the system is singular, the coefficients are not changed then
+*/
+bool calibrate()
+{
+  std::lock_guard<std::mutex> lock(records_mutex);
+  if (records.size() < min_records)return false;
+
+  const std::size_t n = number_of_coefficients;
+  std::vector<std::vector<double>> a(n, std::vector<double>(n + 1, 0)); // augmented matrix [A^T A | A^T b]
+  for (const auto& r : records) {
+	std::vector<double> terms = get_terms(r.first);
+	for (std::size_t i = 0; i != n; ++i) {
+	  for (std::size_t j = 0; j != n; ++j)a[i][j] += terms[i] * terms[j];
+	  a[i][n] += terms[i] * r.second;
+	}
+  }
+
+  // gaussian elimination with partial pivoting
+  for (std::size_t col = 0; col != n; ++col) {
+	std::size_t pivot = col;
+	for (std::size_t row = col + 1; row != n; ++row) {
+	  if (std::abs(a[row][col]) > std::abs(a[pivot][col]))pivot = row;
+	}
+	if (std::abs(a[pivot][col]) < 1e-12)return false;
+	std::swap(a[col], a[pivot]);
+	for (std::size_t row = 0; row != n; ++row) {
+	  if (row == col)continue;
+	  double factor = a[row][col] / a[col][col];
+	  for (std::size_t k = col; k != n + 1; ++k)a[row][k] -= factor * a[col][k];
+	}
+  }
+
+  for (std::size_t i = 0; i != n; ++i)coefficients[i] = a[i][n] / a[i][i];
+  return true;
+}
+
+
+
+/*
+* get the longest-first order of the nefs by the predicted cost and print the predicted time of the block
+* the nefs are not moved, the tasks are submitted in this order and write their results by the input position
+*
+* @param:
+* nefs    : the nefs to be expanded
+* features: will be set to the features of the nefs (input order), for recording the timings
+* pool    : if not null, the features are computed by one task for each nef (exact predicates, not a serial pass
+*           ahead of the parallel phase), its size is the number of tasks running at the same time, for the predicted wall time
+* @return:
+* the indices of the nefs, longest-first (stable for equal costs)
+*/
+std::vector<std::size_t> schedule(const std::vector<Nef_polyhedron>& nefs, std::vector<Features>& features, ThreadPool* pool = nullptr)
+{
+  features.assign(nefs.size(), Features());
+  if (pool != nullptr) {
+	std::vector<std::future<void>> futures;
+	futures.reserve(nefs.size());
+	for (std::size_t i = 0; i != nefs.size(); ++i) {
+	  futures.emplace_back(pool->submit([&nefs, &features, i]() { features[i] = get_features(nefs[i]); }, &futures)); // the futures identify the group
+	}
+	pool->wait_all(futures, &futures);
+  }
+  else {
+	for (std::size_t i = 0; i != nefs.size(); ++i)features[i] = get_features(nefs[i]);
+  }
+
+  std::vector<double> costs;
+  costs.reserve(nefs.size());
+  for (const auto& f : features)costs.push_back(predict(f));
+
+  std::vector<std::size_t> order(nefs.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&costs](std::size_t a, std::size_t b) { return costs[a] > costs[b]; });
+
+  // predicted wall time: greedy longest-first assignment to the threads
+  std::size_t threads = pool != nullptr ? pool->size() : 1;
+  std::vector<double> loads(threads, 0);
+  double total = 0;
+  for (auto i : order) {
+	*std::min_element(loads.begin(), loads.end()) += costs[i];
+	total += costs[i];
+  }
+  std::cout << "predicted minkowski time: " << *std::max_element(loads.begin(), loads.end()) << "s"
+	<< " (" << total << "s in total, longest task: " << (order.empty() ? 0 : costs[order.front()]) << "s)\n";
+  return order;
+}
+
+
+
+/*
+* read the records of previous runs and calibrate the model
+* one record per line: vertices facets reflex_edges seconds
+* return false if the file can not be opened
+*/
+bool read_records(const std::string& filename)
+{
+  std::ifstream in(filename);
+  if (!in.is_open())return false;
+
+  {
+	std::lock_guard<std::mutex> lock(records_mutex);
+	Features features;
+	double seconds;
+	while (in >> features.vertices >> features.facets >> features.reflex_edges >> seconds) {
+	  records.emplace_back(features, seconds);
+	}
+	std::cout << "cost model: " << records.size() << " records read from " << filename << '\n';
+  }
+
+  if (calibrate()) {
+	std::cout << "cost model calibrated:";
+	for (auto c : coefficients)std::cout << ' ' << c;
+	std::cout << '\n';
+  }
+  return true;
+}
+
+
+
+/*
+* write the records (read and recorded in this run), at most max_records: the most recent ones
+* return false if the file can not be opened
+*/
+bool write_records(const std::string& filename)
+{
+  std::ofstream out(filename);
+  if (!out.is_open()) {
+	std::cerr << "Error: Unable to open cost records \"" << filename << "\" for writing!" << std::endl;
+	return false;
+  }
+
+  std::lock_guard<std::mutex> lock(records_mutex);
+  std::size_t first = records.size() > max_records ? records.size() - max_records : 0;
+  for (std::size_t i = first; i != records.size(); ++i) {
+	const auto& r = records[i];
+	out << r.first.vertices << ' ' << r.first.facets << ' ' << r.first.reflex_edges << ' ' << r.second << '\n';
+  }
+  std::cout << "cost records saved at: " << filename << '\n';
+  return true;
+}
+
+
+};
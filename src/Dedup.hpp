@@ -0,0 +1,287 @@
+#pragma once
+
+#include <map>
+#include <sstream>
+#include <algorithm>
+
+#include "Polyhedron.hpp"
+#include "MultiThread.hpp"
+
+
+
+/*
+* class for translation-invariant deduplication of building geometries
+*
+* many blocks contain rows of geometrically identical buildings (e.g. row houses)
+* which only differ by a translation, each of them would get its own nef and minkowski sum
+*
+* thus each building is normalized to a local origin (min corner of its bounding box)
+* and fingerprinted in a canonical form (sorted vertices, rotated and sorted faces)
+* identical shapes are built and expanded only once, the expanded nef is then
+* translated into place for each occurrence
+*
+* since translating an exact nef is exact and minkowski sum commutes with translation
+* the result is the same as expanding each occurrence (up to the fingerprint tolerance)
+*
+* usage:
+* Dedup dedup(tolerance);
+* dedup.build(jhandles, build_options, enable_multi_threading); // instead of Build::build_nef_polyhedron() for each building
+* dedup.expand(expanded_nefs, minkowski_param, enable_multi_threading); // instead of MT::expand_nefs(_async)(), false if abandoned
+*/
+class Dedup
+{
+public:
+
+	/*
+	* @param:
+	* tolerance: coordinates (in the local frame) are compared with this tolerance
+	*/
+	Dedup(double tolerance = 1e-6) : tolerance(tolerance) {}
+
+
+
+	/*
+	* group the buildings by their fingerprints and build one nef for each shape
+	*
+	* @param:
+	* jhandles       : all buildings in one block
+	* options        : see Build_options
+	* multi_threading: if true, the buildings are read and fingerprinted, and the shapes are built, by tasks in the thread pool
+	*                  (see MT::build_nefs_async())
+	*/
+	void build(const std::vector<JsonHandler>& jhandles, const Build_options& options, bool multi_threading = false)
+	{
+		// vertices, faces and fingerprint of each building
+		// the builder is kept for the representatives, so snapping, prescreening and triangulation run once per building
+		std::vector<Polyhedron_builder<Polyhedron::HalfedgeDS>> builders(jhandles.size());
+		std::vector<char> read(jhandles.size(), 0); // not std::vector<bool>, written by several tasks
+		std::vector<std::string> keys(jhandles.size());
+		std::vector<Kernel::Vector_3> origins(jhandles.size());
+		for_each(jhandles.size(), multi_threading, [this, &jhandles, &options, &builders, &read, &keys, &origins](std::size_t i) {
+			read[i] = Build::get_polyhedron_builder(jhandles[i], builders[i], options);
+			if (read[i])keys[i] = fingerprint(builders[i], origins[i]);
+		});
+
+		std::map<std::string, std::size_t> shape_index; // fingerprint -> index in shapes
+		for (std::size_t i = 0; i != jhandles.size(); ++i) {
+			if (!read[i])continue;
+
+			auto found = shape_index.find(keys[i]);
+			if (found == shape_index.end()) {
+				// new shape, the building is the representative of this shape
+				shape_index.emplace(keys[i], shapes.size());
+				shapes.emplace_back();
+				shapes.back().representative = i;
+				shapes.back().origin = origins[i];
+			}
+			else {
+				// already known shape, store the translation from the representative
+				Shape& shape = shapes[found->second];
+				shape.translations.push_back(origins[i] - shape.origin);
+			}
+		}
+
+		// one nef for each shape, from the builder of its representative
+		for_each(shapes.size(), multi_threading, [this, &jhandles, &options, &builders](std::size_t s) {
+			std::size_t i = shapes[s].representative;
+			shapes[s].built = Build::build_nef_polyhedron(builders[i], jhandles[i].solids[0].id, shapes[s].nef, options);
+		});
+
+		std::size_t occurrences = 0;
+		for (const auto& shape : shapes)occurrences += 1 + shape.translations.size();
+		std::cout << "deduplication: " << occurrences << " buildings, " << shapes.size() << " unique shapes\n";
+	}
+
+
+
+	/*
+	* expand each unique shape once and translate the expanded nef into place for each occurrence
+	*
+	* @param:
+	* expanded_nefs    : the expanded nefs of all occurrences will be added to this vector
+	* minkowski_param  : the "minkowski parameter", see MT::expand_nef()
+	* multi_threading  : if true, the unique shapes are expanded by an Executor in the thread pool (see MT::expand_nefs_async())
+	* @return:
+	* false if the block is abandoned (MT::max_failures minkowski sums failed), expanded_nefs holds the finished shapes then
+	*/
+	bool expand(std::vector<Nef_polyhedron>& expanded_nefs, double minkowski_param, bool multi_threading)
+	{
+		// one result vector for each shape, so the expanded nef can be traced back to its shape
+		std::vector<std::vector<Nef_polyhedron>> expanded_shapes(shapes.size());
+		bool abandoned = false;
+
+		if (multi_threading) {
+			// one task for each shape, its slot is written by MT::expand_nef_async()
+			std::vector<MT::Slot> slots(shapes.size());
+			Executor executor(MT::get_pool(), MT::max_failures);
+			for (std::size_t s = 0; s != shapes.size(); ++s) {
+				if (!shapes[s].built)continue;
+				executor.submit("shape " + std::to_string(s), [this, s, &slots, minkowski_param]() {
+					return MT::expand_nef_async(shapes[s].nef.front(), &slots[s], minkowski_param);
+				});
+			}
+			executor.wait();
+			executor.print_summary("minkowski sums (unique shapes)");
+			abandoned = executor.cancelled();
+
+			for (std::size_t s = 0; s != shapes.size(); ++s) {
+				if (slots[s].done.load(std::memory_order_acquire) && slots[s].expanded)expanded_shapes[s].emplace_back(std::move(slots[s].nef));
+			}
+		}
+		else {
+			for (std::size_t s = 0; s != shapes.size(); ++s) {
+				if (!shapes[s].built)continue;
+				MT::expand_nef(shapes[s].nef.front(), &expanded_shapes[s], minkowski_param);
+			}
+		}
+
+		// place the occurrences
+		for (std::size_t s = 0; s != shapes.size(); ++s) {
+			for (const auto& expanded_nef : expanded_shapes[s]) {
+				expanded_nefs.push_back(expanded_nef); // the representative itself
+
+				for (const auto& translation : shapes[s].translations) {
+					Nef_polyhedron translated_nef(expanded_nef);
+					translated_nef.transform(Kernel::Aff_transformation_3(CGAL::TRANSLATION, translation));
+					expanded_nefs.push_back(translated_nef);
+				}
+			}
+		}
+		return !abandoned;
+	}
+
+
+
+	/*
+	* number of unique shapes
+	*/
+	std::size_t number_of_shapes() const { return shapes.size(); }
+
+
+
+protected:
+
+	/*
+	* run task(0) ... task(count - 1), one task for each index in the thread pool if multi_threading is set
+	* each task only writes its own elements, thus no lock is needed
+	*/
+	template<class Task>
+	static void for_each(std::size_t count, bool multi_threading, const Task& task)
+	{
+		if (!multi_threading) {
+			for (std::size_t i = 0; i != count; ++i)task(i);
+			return;
+		}
+
+		ThreadPool& pool = MT::get_pool();
+		std::vector<std::future<void>> futures;
+		futures.reserve(count);
+		for (std::size_t i = 0; i != count; ++i) {
+			futures.emplace_back(pool.submit([&task, i]() { task(i); }, &futures)); // the futures identify the group, see ThreadPool::wait()
+		}
+		pool.wait_all(futures, &futures);
+	}
+
+
+
+	/*
+	* get the canonical fingerprint of a building in its local frame
+	* (1) local origin: min corner of the bounding box
+	* (2) local coordinates are rounded to the tolerance
+	* (3) vertices are sorted, faces are remapped, rotated to start with the smallest index and sorted
+	*
+	* @param:
+	* polyhedron_builder: vertices and faces of the building
+	* origin            : will be set to the local origin (exact)
+	* @return:
+	* the fingerprint string
+	*/
+	std::string fingerprint(const Polyhedron_builder<Polyhedron::HalfedgeDS>& polyhedron_builder, Kernel::Vector_3& origin) const
+	{
+		const auto& vertices = polyhedron_builder.vertices;
+		if (vertices.empty()) {
+			origin = Kernel::Vector_3(0, 0, 0);
+			return std::string();
+		}
+
+		// (1) local origin
+		double xmin = CGAL::to_double(vertices[0].x());
+		double ymin = CGAL::to_double(vertices[0].y());
+		double zmin = CGAL::to_double(vertices[0].z());
+		for (const auto& v : vertices) {
+			xmin = std::min(xmin, CGAL::to_double(v.x()));
+			ymin = std::min(ymin, CGAL::to_double(v.y()));
+			zmin = std::min(zmin, CGAL::to_double(v.z()));
+		}
+		origin = Kernel::Vector_3(xmin, ymin, zmin);
+
+		// (2) rounded local coordinates
+		typedef std::tuple<long long, long long, long long> Grid_point;
+		std::vector<Grid_point> local_points;
+		local_points.reserve(vertices.size());
+		for (const auto& v : vertices) {
+			local_points.emplace_back(
+				std::llround((CGAL::to_double(v.x()) - xmin) / tolerance),
+				std::llround((CGAL::to_double(v.y()) - ymin) / tolerance),
+				std::llround((CGAL::to_double(v.z()) - zmin) / tolerance));
+		}
+
+		// (3) canonical vertex order
+		std::vector<std::size_t> order(vertices.size());
+		for (std::size_t i = 0; i != order.size(); ++i)order[i] = i;
+		std::sort(order.begin(), order.end(), [&local_points](std::size_t a, std::size_t b) {
+			return local_points[a] < local_points[b];
+		});
+		std::vector<std::size_t> rank(vertices.size());
+		for (std::size_t r = 0; r != order.size(); ++r)rank[order[r]] = r;
+
+		// canonical faces - keep the orientation, only rotate the start
+		std::vector<std::vector<std::size_t>> canonical_faces;
+		canonical_faces.reserve(polyhedron_builder.faces.size());
+		for (const auto& face : polyhedron_builder.faces) {
+			std::vector<std::size_t> canonical_face;
+			canonical_face.reserve(face.size());
+			for (auto index : face)canonical_face.push_back(rank[index]);
+			std::rotate(canonical_face.begin(), std::min_element(canonical_face.begin(), canonical_face.end()), canonical_face.end());
+			canonical_faces.emplace_back(std::move(canonical_face));
+		}
+		std::sort(canonical_faces.begin(), canonical_faces.end());
+
+		// write the fingerprint
+		std::ostringstream key;
+		key << vertices.size() << ' ' << canonical_faces.size() << '|';
+		for (auto i : order) {
+			key << std::get<0>(local_points[i]) << ',' << std::get<1>(local_points[i]) << ',' << std::get<2>(local_points[i]) << ';';
+		}
+		key << '|';
+		for (const auto& face : canonical_faces) {
+			for (auto index : face)key << index << ',';
+			key << ';';
+		}
+		return key.str();
+	}
+
+
+
+protected:
+
+	/*
+	* one unique shape
+	* representative: index of the building (in jhandles) which is built and expanded
+	* origin        : local origin of the representative
+	* nef           : the built nef of the representative (empty if building failed)
+	* built         : whether the nef is built
+	* translations  : translation from the representative to each other occurrence
+	*/
+	struct Shape
+	{
+		std::size_t representative = 0;
+		Kernel::Vector_3 origin;
+		std::vector<Nef_polyhedron> nef;
+		bool built = false;
+		std::vector<Kernel::Vector_3> translations;
+	};
+
+	double tolerance;
+	std::vector<Shape> shapes;
+};
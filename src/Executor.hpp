@@ -0,0 +1,249 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <iostream>
+
+#include "ThreadPool.hpp"
+
+
+
+/*
+* status of one task of an Executor
+* PENDING  : submitted, not finished yet
+* SUCCESS  : done as requested
+* FALLBACK : done with a replacement (e.g. the convex hull or a lower rung of the ladder)
+* FAILED   : no result (returned FAILED or threw an exception)
+* TIMED_OUT: exceeded the time budget, replaced (see Budget)
+* CANCELLED: not started because the executor was cancelled
+*/
+enum class Task_status { PENDING, SUCCESS, FALLBACK, FAILED, TIMED_OUT, CANCELLED };
+
+
+/*
+* report of one task
+*/
+struct Task_report
+{
+  std::string name;
+  Task_status status = Task_status::PENDING;
+  double seconds = 0; // run time of the task
+  std::string message; // e.g. the message of the exception
+};
+
+
+
+/*
+* class for running one group of tasks (e.g. the minkowski sums of one block) in the thread pool
+*
+* each executor owns its task handles and reports, thus several executors (blocks) can run at the same time
+* in one pool without sharing any state, and an executor can be reused after wait() (see reset())
+*
+* cancel() abandons the group: the tasks which are not started yet are not run (CANCELLED),
+* running tasks are finished (CGAL can not be interrupted, see Budget for killing a single task)
+* with max_failures > 0 the executor cancels itself when that many tasks failed (a doomed block)
+*
+* usage:
+* Executor executor(MT::get_pool(), max_failures);
+* std::size_t handle = executor.submit(name, []() { ...; return Task_status::SUCCESS; });
+* executor.wait();                                 // a worker runs pending tasks of this executor meanwhile
+* executor.status(handle); executor.report(handle); executor.print_summary();
+*/
+class Executor
+{
+public:
+
+	/*
+	* @param:
+	* pool        : the pool running the tasks
+	* max_failures: cancel the remaining tasks when this many tasks failed, 0 -> never
+	*/
+	Executor(ThreadPool& pool, std::size_t max_failures = 0) : pool(pool), max_failures(max_failures) {}
+
+	/*
+	* the tasks refer to the executor, wait for them
+	*/
+	~Executor()
+	{
+		cancel();
+		try { wait(); }
+		catch (...) {}
+	}
+
+	Executor(const Executor&) = delete;
+	Executor& operator=(const Executor&) = delete;
+
+
+
+	/*
+	* submit a task
+	* @return:
+	* the handle of the task, for status() and report()
+	*/
+	std::size_t submit(const std::string& name, std::function<Task_status()> task)
+	{
+		Task_report* report_ptr = nullptr;
+		std::size_t handle = 0;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			handle = reports.size();
+			reports.emplace_back();
+			reports.back().name = name;
+			report_ptr = &reports.back(); // the elements of a deque are not moved by emplace_back()
+		}
+
+		std::future<void> future = pool.submit([this, report_ptr, task]() {
+			if (is_cancelled.load()) {
+				finish(*report_ptr, Task_status::CANCELLED, 0, "");
+				return;
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			Task_status status = Task_status::FAILED;
+			std::string message;
+			try {
+				status = task();
+			}
+			catch (const std::exception& e) {
+				message = e.what();
+			}
+			catch (...) {
+				message = "unknown error";
+			}
+			finish(*report_ptr, status, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), message);
+		}, this);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		futures.emplace_back(std::move(future));
+		return handle;
+	}
+
+
+
+	/*
+	* cancel the tasks which are not started yet
+	*/
+	void cancel()
+	{
+		is_cancelled.store(true);
+	}
+
+	bool cancelled() const
+	{
+		return is_cancelled.load();
+	}
+
+
+
+	/*
+	* wait for all submitted tasks, a calling worker runs pending tasks of this executor meanwhile
+	* more tasks can be submitted after wait(), the reports and the cancellation are kept until reset()
+	*/
+	void wait()
+	{
+		std::vector<std::future<void>> submitted;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			submitted.swap(futures);
+		}
+		pool.wait_all(submitted, this); // the tasks do not throw, the exceptions are reported
+	}
+
+
+
+	/*
+	* clear the reports and the cancellation, after wait()
+	*/
+	void reset()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		reports.clear();
+		failures = 0;
+		is_cancelled.store(false);
+	}
+
+
+
+	Task_status status(std::size_t handle)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return reports[handle].status;
+	}
+
+	Task_report report(std::size_t handle)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return reports[handle];
+	}
+
+	std::size_t count(Task_status status)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::size_t n = 0;
+		for (const auto& r : reports)if (r.status == status)++n;
+		return n;
+	}
+
+
+
+	/*
+	* print the number of tasks of each status, the failed tasks and the slowest task
+	*/
+	void print_summary(const std::string& label = "tasks")
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::size_t n[6] = { 0, 0, 0, 0, 0, 0 };
+		const Task_report* slowest = nullptr;
+		for (const auto& r : reports) {
+			++n[(int)r.status];
+			if (r.status == Task_status::FAILED) {
+				std::cout << "failed: " << r.name << (r.message.empty() ? "" : " (" + r.message + ")") << '\n';
+			}
+			if (slowest == nullptr || r.seconds > slowest->seconds)slowest = &r;
+		}
+		std::cout << label << ": " << n[(int)Task_status::SUCCESS] << " success, " << n[(int)Task_status::FALLBACK] << " fallback, "
+			<< n[(int)Task_status::FAILED] << " failed, " << n[(int)Task_status::TIMED_OUT] << " timed out, "
+			<< n[(int)Task_status::CANCELLED] << " cancelled";
+		if (slowest != nullptr)std::cout << " (slowest: " << slowest->name << ", " << slowest->seconds << "s)";
+		std::cout << '\n';
+	}
+
+
+
+protected:
+
+	/*
+	* write the result of a task, cancel the executor if too many tasks failed
+	*/
+	void finish(Task_report& report, Task_status status, double seconds, const std::string& message)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		report.status = status;
+		report.seconds = seconds;
+		report.message = message;
+		if (status == Task_status::FAILED && max_failures != 0 && ++failures >= max_failures && !is_cancelled.load()) {
+			std::cout << "too many failed tasks (" << failures << "), the remaining tasks are cancelled\n";
+			is_cancelled.store(true);
+		}
+	}
+
+
+
+protected:
+
+	ThreadPool& pool;
+	std::size_t max_failures;
+	std::size_t failures = 0; // guarded by mutex
+
+	std::deque<Task_report> reports; // one for each task, guarded by mutex
+	std::vector<std::future<void>> futures; // handles of the submitted tasks, cleared by wait(), guarded by mutex
+	std::mutex mutex;
+	std::atomic<bool> is_cancelled{ false };
+};
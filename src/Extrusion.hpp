@@ -0,0 +1,354 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <tuple>
+
+#include "Polyhedron.hpp"
+
+// 2D polygons and booleans
+#include <CGAL/Polygon_2.h>
+#include <CGAL/Polygon_with_holes_2.h>
+#include <CGAL/Polygon_set_2.h>
+#include <CGAL/minkowski_sum_2.h>
+
+
+// typedefs
+typedef Kernel::Point_2                     Point_2;
+typedef CGAL::Polygon_2<Kernel>             Polygon_2;
+typedef CGAL::Polygon_with_holes_2<Kernel>  Polygon_with_holes_2;
+typedef CGAL::Polygon_set_2<Kernel>         Polygon_set_2;
+
+
+
+/*
+* one prism of a 2.5D building: footprint extruded from z0 to z1
+*/
+struct Prism
+{
+	Polygon_2 footprint; // counter-clockwise
+	double z0;
+	double z1;
+};
+
+
+
+/*
+* 2.5D engine for LoD1.2 / LoD1.3
+*
+* LoD1.2 buildings are single prisms and LoD1.3 buildings are stacks of prisms (vertical walls, flat roofs)
+* minkowski sum of a prism with the cube [0, size]^3 is the footprint offset by the square [0, size]^2
+* extruded from z0 to z1 + size
+*
+* thus the expansion and the union of a block are done in 2D with polygon booleans:
+* (1) each building is decomposed into prisms: every up-facing horizontal face (roof) is a prism from the ground to the roof
+* (2) the footprints are offset by the square (2D minkowski sum)
+* (3) for each slab between two consecutive height levels, the cross-section is the union of the covering prisms
+* (4) the slabs are extruded back to a solid: walls of each cross-section, horizontal faces where adjacent cross-sections differ
+*     every edge at a height level is split at all boundary vertices of that level (walls above and below, horizontal faces),
+*     thus neighbouring faces share their edges (no T-junctions) and the result is watertight
+*
+* no Nef_polyhedron is built, the result is a polygon soup stored in a Shell_explorer
+*/
+class Extrusion
+{
+public:
+
+	/*
+	* get the prisms of one building
+	*
+	* @param:
+	* jhandle: the building
+	* prisms : prisms of the building will be added
+	* options: see Build_options, the vertices are snapped to options.snap_grid (if set)
+	* @return:
+	* false if the building is not 2.5D (a face is neither horizontal nor vertical), prisms is not changed
+	*/
+	static bool get_prisms(const JsonHandler& jhandle, std::vector<Prism>& prisms, const Build_options& options = Build_options())
+	{
+		Polyhedron_builder<Polyhedron::HalfedgeDS> polyhedron_builder;
+		if (!Build::get_polyhedron_builder(jhandle, polyhedron_builder, options))return false;
+
+		const auto& vertices = polyhedron_builder.vertices;
+		if (vertices.empty())return false;
+
+		double zmin = CGAL::to_double(vertices[0].z());
+		for (const auto& v : vertices)zmin = std::min(zmin, CGAL::to_double(v.z()));
+
+		std::vector<Prism> building_prisms;
+		for (const auto& face : polyhedron_builder.faces) {
+			if (face.size() < 3)continue;
+
+			// normal - Newell's method
+			double nx = 0, ny = 0, nz = 0;
+			for (std::size_t i = 0; i != face.size(); ++i) {
+				const Point_3& p = vertices[face[i]];
+				const Point_3& q = vertices[face[(i + 1) % face.size()]];
+				double px = CGAL::to_double(p.x()), py = CGAL::to_double(p.y()), pz = CGAL::to_double(p.z());
+				double qx = CGAL::to_double(q.x()), qy = CGAL::to_double(q.y()), qz = CGAL::to_double(q.z());
+				nx += (py - qy) * (pz + qz);
+				ny += (pz - qz) * (px + qx);
+				nz += (px - qx) * (py + qy);
+			}
+			double length = std::sqrt(nx * nx + ny * ny + nz * nz);
+			if (length < epsilon)continue; // degenerate face
+			nz /= length;
+
+			if (std::abs(nz) < 1e-6)continue; // vertical wall
+			if (std::abs(nz) < 1 - 1e-6)return false; // sloped face, not 2.5D
+			if (nz < 0)continue; // ground face
+
+			// roof face -> one prism from the ground to the roof
+			Prism prism;
+			prism.z0 = zmin;
+			prism.z1 = CGAL::to_double(vertices[face[0]].z());
+			for (auto index : face) {
+				prism.footprint.push_back(Point_2(vertices[index].x(), vertices[index].y()));
+			}
+			if (!prism.footprint.is_simple())return false;
+			if (prism.footprint.is_clockwise_oriented())prism.footprint.reverse_orientation();
+			building_prisms.emplace_back(prism);
+		}
+		if (building_prisms.empty())return false;
+
+		prisms.insert(prisms.end(), building_prisms.begin(), building_prisms.end());
+		return true;
+	}
+
+
+
+	/*
+	* expand and union the prisms of a block
+	*
+	* @param:
+	* prisms : prisms of all buildings in the block
+	* size   : the cube's side length (minkowski param)
+	* shell  : the result (vertices, faces and cleaned_vertices, cleaned_faces) will be stored in this shell
+	* @return:
+	* false if a horizontal face with holes can not be triangulated (the shell is not set), the cgal engine is used then
+	*/
+	static bool expand_and_union(const std::vector<Prism>& prisms, double size, Shell_explorer& shell)
+	{
+		std::cout << "2.5D expansion of " << prisms.size() << " prisms ...\n";
+
+		// (2) offset the footprints by the square [0, size]^2
+		Polygon_2 square;
+		square.push_back(Point_2(0, 0));
+		square.push_back(Point_2(size, 0));
+		square.push_back(Point_2(size, size));
+		square.push_back(Point_2(0, size));
+
+		std::vector<Polygon_with_holes_2> expanded_footprints;
+		std::set<double> level_set;
+		expanded_footprints.reserve(prisms.size());
+		for (const auto& prism : prisms) {
+			expanded_footprints.push_back(CGAL::minkowski_sum_2(prism.footprint, square));
+			level_set.insert(prism.z0);
+			level_set.insert(prism.z1 + size);
+		}
+		std::vector<double> levels(level_set.begin(), level_set.end());
+
+		// (3) cross-section of each slab [levels[k], levels[k + 1]]
+		std::vector<Polygon_set_2> sections(levels.size() > 0 ? levels.size() - 1 : 0);
+		for (std::size_t k = 0; k + 1 < levels.size(); ++k) {
+			for (std::size_t i = 0; i != prisms.size(); ++i) {
+				if (prisms[i].z0 <= levels[k] && prisms[i].z1 + size >= levels[k + 1]) {
+					sections[k].join(expanded_footprints[i]);
+				}
+			}
+		}
+
+		// (4) extrude back to a solid
+		// the boundary vertices at each level: top of the slab below, bottom of the slab above, horizontal faces
+		std::vector<Polygon_set_2> up_facings(levels.size()), down_facings(levels.size());
+		std::vector<std::set<Point_2>> level_points(levels.size());
+		for (std::size_t k = 0; k != levels.size(); ++k) {
+			Polygon_set_2 below = (k > 0) ? sections[k - 1] : Polygon_set_2();
+			Polygon_set_2 above = (k < sections.size()) ? sections[k] : Polygon_set_2();
+
+			up_facings[k] = below; // roofs
+			up_facings[k].difference(above);
+			down_facings[k] = above; // floors and overhangs
+			down_facings[k].difference(below);
+
+			add_points(below, level_points[k]);
+			add_points(above, level_points[k]);
+			add_points(up_facings[k], level_points[k]);
+			add_points(down_facings[k], level_points[k]);
+		}
+
+		std::map<std::tuple<double, double, double>, unsigned long> vertex_index;
+		std::vector<Point_3> vertices;
+		auto get_index = [&vertex_index, &vertices](const Point_2& p, double z) {
+			double x = CGAL::to_double(p.x());
+			double y = CGAL::to_double(p.y());
+			auto inserted = vertex_index.emplace(std::make_tuple(x, y, z), (unsigned long)vertices.size());
+			if (inserted.second)vertices.emplace_back(x, y, z);
+			return inserted.first->second;
+		};
+
+		std::vector<std::vector<unsigned long>> faces;
+
+		// walls
+		for (std::size_t k = 0; k != sections.size(); ++k) {
+			std::vector<Polygon_with_holes_2> polygons;
+			sections[k].polygons_with_holes(std::back_inserter(polygons));
+			for (const auto& polygon : polygons) {
+				add_walls(polygon.outer_boundary(), levels[k], levels[k + 1], level_points[k], level_points[k + 1], get_index, faces);
+				for (auto hole = polygon.holes_begin(); hole != polygon.holes_end(); ++hole) {
+					add_walls(*hole, levels[k], levels[k + 1], level_points[k], level_points[k + 1], get_index, faces);
+				}
+			}
+		}
+
+		// horizontal faces, where the cross-sections below and above differ
+		for (std::size_t k = 0; k != levels.size(); ++k) {
+			if (!add_horizontal_faces(up_facings[k], levels[k], true, level_points[k], get_index, vertices, faces) ||
+				!add_horizontal_faces(down_facings[k], levels[k], false, level_points[k], get_index, vertices, faces)) {
+				std::cout << "a horizontal face with holes at z = " << levels[k] << " can not be triangulated\n";
+				return false;
+			}
+		}
+
+		// store the result
+		shell.vertices = vertices;
+		shell.faces = faces;
+		shell.cleaned_vertices = vertices;
+		shell.cleaned_faces = faces;
+
+		std::cout << "done\n";
+		return true;
+	}
+
+
+
+protected:
+
+	/*
+	* add the vertices of all boundaries of a polygon set to points
+	*/
+	static void add_points(const Polygon_set_2& polygon_set, std::set<Point_2>& points)
+	{
+		std::vector<Polygon_with_holes_2> polygons;
+		polygon_set.polygons_with_holes(std::back_inserter(polygons));
+		for (const auto& polygon : polygons) {
+			points.insert(polygon.outer_boundary().vertices_begin(), polygon.outer_boundary().vertices_end());
+			for (auto hole = polygon.holes_begin(); hole != polygon.holes_end(); ++hole) {
+				points.insert(hole->vertices_begin(), hole->vertices_end());
+			}
+		}
+	}
+
+
+
+	/*
+	* get the points lying strictly inside the segment p -> q, ordered from p to q (exact predicates)
+	*/
+	static std::vector<Point_2> split_points(const Point_2& p, const Point_2& q, const std::set<Point_2>& points)
+	{
+		std::vector<Point_2> inside;
+		for (const auto& r : points) {
+			if (CGAL::collinear(p, r, q) && CGAL::collinear_are_strictly_ordered_along_line(p, r, q)) {
+				inside.push_back(r);
+			}
+		}
+		std::sort(inside.begin(), inside.end(), [&p](const Point_2& a, const Point_2& b) {
+			return CGAL::has_smaller_distance_to_point(p, a, b);
+		});
+		return inside;
+	}
+
+
+
+	/*
+	* add the walls of one boundary (outer boundary counter-clockwise, holes clockwise) between z0 and z1
+	* the walls face outwards
+	* the bottom edge is split at the points of level z0, the top edge at the points of level z1
+	*/
+	template <class Get_index>
+	static void add_walls(
+		const Polygon_2& boundary, double z0, double z1,
+		const std::set<Point_2>& points0, const std::set<Point_2>& points1,
+		Get_index& get_index,
+		std::vector<std::vector<unsigned long>>& faces)
+	{
+		for (auto e = boundary.edges_begin(); e != boundary.edges_end(); ++e) {
+			const Point_2& p = e->source();
+			const Point_2& q = e->target();
+
+			std::vector<unsigned long> face;
+			face.push_back(get_index(p, z0));
+			for (const auto& r : split_points(p, q, points0))face.push_back(get_index(r, z0));
+			face.push_back(get_index(q, z0));
+			face.push_back(get_index(q, z1));
+			for (const auto& r : split_points(q, p, points1))face.push_back(get_index(r, z1));
+			face.push_back(get_index(p, z1));
+			faces.emplace_back(std::move(face));
+		}
+	}
+
+
+
+	/*
+	* the indices of a ring at height z, each edge split at the points of the level
+	*/
+	template <class Get_index>
+	static std::vector<unsigned long> ring_indices(
+		const Polygon_2& ring, double z,
+		const std::set<Point_2>& points,
+		Get_index& get_index)
+	{
+		std::vector<unsigned long> indices;
+		for (auto e = ring.edges_begin(); e != ring.edges_end(); ++e) {
+			indices.push_back(get_index(e->source(), z));
+			for (const auto& r : split_points(e->source(), e->target(), points))indices.push_back(get_index(r, z));
+		}
+		return indices;
+	}
+
+
+
+	/*
+	* add the horizontal faces of a polygon set at height z
+	* faces with holes are triangulated (see Build::triangulate_face_with_holes())
+	* up    : true if the faces should face upwards
+	* points: the boundary vertices of the level, the edges are split at them
+	* return false if a face with holes can not be triangulated (its cap would cover the holes)
+	*/
+	template <class Get_index>
+	static bool add_horizontal_faces(
+		const Polygon_set_2& polygon_set, double z, bool up,
+		const std::set<Point_2>& points,
+		Get_index& get_index,
+		const std::vector<Point_3>& vertices,
+		std::vector<std::vector<unsigned long>>& faces)
+	{
+		std::vector<Polygon_with_holes_2> polygons;
+		polygon_set.polygons_with_holes(std::back_inserter(polygons));
+
+		for (const auto& polygon : polygons) {
+			// rings: outer boundary counter-clockwise (facing upwards), holes clockwise
+			Face face;
+			face.rings.emplace_back();
+			face.rings.back().indices = ring_indices(polygon.outer_boundary(), z, points, get_index);
+			for (auto hole = polygon.holes_begin(); hole != polygon.holes_end(); ++hole) {
+				face.rings.emplace_back();
+				face.rings.back().indices = ring_indices(*hole, z, points, get_index);
+			}
+
+			std::vector<std::vector<unsigned long>> new_faces;
+			if (face.rings.size() == 1) {
+				new_faces.push_back(face.rings.front().indices);
+			}
+			else if (!Build::triangulate_face_with_holes(vertices, face, new_faces)) {
+				return false;
+			}
+
+			for (auto& new_face : new_faces) {
+				if (!up)std::reverse(new_face.begin(), new_face.end());
+				faces.emplace_back(std::move(new_face));
+			}
+		}
+		return true;
+	}
+};
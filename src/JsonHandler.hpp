@@ -276,6 +276,9 @@ public:
 protected:
 	std::vector<Point_3> vertices; // store all vertices of one building
 	std::vector<Solid> solids; // store all solids of one building, ideally one solid for each building
+	friend class Snap; // for the building ids
+	friend class Bridge; // for the building ids
+	friend class Dedup; // for the building ids
 
 	friend class Build; // friend class to access the protected members
 };
@@ -96,11 +96,16 @@ namespace FileIO {
 	* pre-condition: the big nef is simple
 	* can choose to triangulate the surfaces or not
 	*/
+	bool write_OFF(const std::string& filename, const Shell_explorer& shell); // see below
+
 	bool write_OFF(const std::string& filename, Nef_polyhedron& big_nef, bool triangulate_tag = false) {
 		
 		Polyhedron polyhedron;
 
-		if (!big_nef.is_simple()) {
+		// is_simple() is the precondition of the conversion, always checked, only recorded according to the validation level
+		bool simple = big_nef.is_simple();
+		if (Validation::should_check())Validation::record("big nef is_simple", filename, simple);
+		if (!simple) {
 			std::cerr << "big nef is not simple, can not convert to polyhedron, please check" << '\n';
 			return false;
 		}
@@ -112,6 +117,25 @@ namespace FileIO {
 			CGAL::Polygon_mesh_processing::triangulate_faces(polyhedron);
 		} // this may not be needed since in the construction of nef poyhedra triangulation has been applied
 
+		// deterministic output: write the polyhedron as a canonical polygon soup (see NefProcessing::canonicalize())
+		if (NefProcessing::deterministic) {
+			Shell_explorer shell;
+			std::map<const void*, unsigned long> indices; // vertex -> index, the address is only used for the lookup
+			for (auto v = polyhedron.vertices_begin(); v != polyhedron.vertices_end(); ++v) {
+				indices[&*v] = (unsigned long)shell.cleaned_vertices.size();
+				shell.cleaned_vertices.push_back(v->point());
+			}
+			for (auto f = polyhedron.facets_begin(); f != polyhedron.facets_end(); ++f) {
+				shell.cleaned_faces.emplace_back();
+				auto h = f->facet_begin();
+				do {
+					shell.cleaned_faces.back().push_back(indices[&*h->vertex()]);
+				} while (++h != f->facet_begin());
+			}
+			NefProcessing::canonicalize(shell.cleaned_vertices, shell.cleaned_faces);
+			return write_OFF(filename, shell);
+		}
+
 		// output
 		std::ofstream out_stream(filename);
 		out_stream.precision(17); // why use 17? from CGAL docs setting precisions can reduce the self-intersection errors in the output
@@ -123,6 +147,37 @@ namespace FileIO {
 
 
 
+	/*
+	* write a shell (polygon soup) to OFF file (Object File Format)
+	* used for the results which are not nef polyhedra (e.g. 2.5D extrusion)
+	* the cleaned_vertices and cleaned_faces of the shell are written
+	*/
+	bool write_OFF(const std::string& filename, const Shell_explorer& shell) {
+
+		std::ofstream out_stream(filename);
+		if (!out_stream.is_open()) {
+			std::cerr << "Error: Unable to open OFF file \"" << filename << "\" for writing!" << std::endl;
+			return false;
+		}
+
+		out_stream.precision(17); // the same precision as write_OFF() for nef
+		out_stream << "OFF\n";
+		out_stream << shell.cleaned_vertices.size() << ' ' << shell.cleaned_faces.size() << " 0\n";
+		for (auto const& v : shell.cleaned_vertices) {
+			out_stream << CGAL::to_double(v.x()) << ' ' << CGAL::to_double(v.y()) << ' ' << CGAL::to_double(v.z()) << '\n';
+		}
+		for (auto const& face : shell.cleaned_faces) {
+			out_stream << face.size();
+			for (auto index : face)out_stream << ' ' << index;
+			out_stream << '\n';
+		}
+		out_stream.close();
+		std::cout << "file saved at: " << filename << '\n';
+		return true;
+	}
+
+
+
 	/*
 	* write the big nef to STL file (STereoLithography File Format)
 	* return true if successful otherwise false
@@ -0,0 +1,437 @@
+#pragma once
+
+#include <map>
+#include <fstream>
+#include <cmath>
+#include <sstream>
+#include <mutex>
+
+#include "Polyhedron.hpp"
+#include "Budget.hpp"
+
+
+
+/*
+* namespace Ladder -> retry ladder for failing minkowski sums
+*
+* if minkowski sum of a nef fails, the nef is retried with cheaper / coarser rungs one after another:
+*
+* DIRECT       - NefProcessing::minkowski_sum() with the selected engine
+* SNAPPED      - the nef is converted to a polyhedron, its vertices are snapped to a grid (snap_grid) and then expanded
+* PERTURBED    - the cube size is slightly changed (minkowski_param * (1 + perturbation))
+* DECOMPOSITION- NefProcessing::minkowski_sum_decomposition()
+* LOD1         - a LoD1 stand-in: the ground faces of the nef extruded to its highest point, expanded piece by piece
+* HULL         - the convex hull of the nef, expanded
+*
+* each rung can be given a time budget (seconds), a rung exceeding it is cancelled and the next rung is tried
+* (the rung runs in a killable worker process, see Budget::run())
+*
+* the rung which succeeded is recorded for each nef (keyed by the size and the position of the nef)
+* the records can be written to a file and read in by a later run, the later run starts at the recorded rung directly
+*
+* usage:
+* Ladder::parse("direct,snapped,hull");   // the ladder is disabled if no rung is set
+* Ladder::read_records(file);             // optional
+* Ladder::expand(nef, minkowski_param, expanded_nef);
+* Ladder::write_records(file);            // optional
+*/
+namespace Ladder {
+
+
+enum class Rung { DIRECT, SNAPPED, PERTURBED, DECOMPOSITION, LOD1, HULL, FAILED };
+typedef Budget::Status Rung_status;
+
+
+std::vector<Rung> rungs; // the ladder, empty -> disabled
+double time_budget = 0; // seconds for each rung, 0 -> no budget
+double snap_grid = 0.001; // for SNAPPED rung
+double perturbation = 0.05; // for PERTURBED rung, relative change of the cube size
+
+std::map<std::string, Rung> known_rungs; // read from a previous run
+std::map<std::string, Rung> records; // rungs which succeeded in this run
+std::mutex records_mutex; // for thread-safety, nefs can be expanded in multi threading process
+
+
+
+/*
+* get the string of a rung, used for the records and for prompting info
+*/
+std::string rung_string(Rung rung)
+{
+  switch (rung) {
+  case Rung::DIRECT: return "direct";
+  case Rung::SNAPPED: return "snapped";
+  case Rung::PERTURBED: return "perturbed";
+  case Rung::DECOMPOSITION: return "decomposition";
+  case Rung::LOD1: return "lod1";
+  case Rung::HULL: return "hull";
+  default: return "failed";
+  }
+}
+
+
+
+/*
+* get a rung from a string
+* return false if the string is not a rung
+*/
+bool get_rung(const std::string& s, Rung& rung)
+{
+  for (Rung r : { Rung::DIRECT, Rung::SNAPPED, Rung::PERTURBED, Rung::DECOMPOSITION, Rung::LOD1, Rung::HULL, Rung::FAILED }) {
+	if (rung_string(r) == s) {
+	  rung = r;
+	  return true;
+	}
+  }
+  return false;
+}
+
+
+
+/*
+* set the ladder from a comma separated list, e.g. "direct,snapped,perturbed,decomposition,lod1,hull"
+* return false if the list contains an unknown rung
+*/
+bool parse(const std::string& list)
+{
+  rungs.clear();
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+	if (item.empty())continue;
+	Rung rung;
+	if (!get_rung(item, rung) || rung == Rung::FAILED) {
+	  std::cerr << "unknown rung: " << item << '\n';
+	  rungs.clear();
+	  return false;
+	}
+	rungs.push_back(rung);
+  }
+  return true;
+}
+
+
+
+/*
+* whether the ladder is used
+*/
+bool enabled()
+{
+  return !rungs.empty();
+}
+
+
+
+/*
+* key of a nef for the records: number of vertices, number of facets and the min corner of its bounding box (mm)
+* the same building gives the same key in another run with the same input and options
+*/
+std::string get_key(const Nef_polyhedron& nef)
+{
+  double xmin = 1e12, ymin = 1e12, zmin = 1e12;
+  Nef_polyhedron::Vertex_const_iterator v;
+  for (v = nef.vertices_begin(); v != nef.vertices_end(); ++v) {
+	xmin = std::min(xmin, CGAL::to_double(v->point().x()));
+	ymin = std::min(ymin, CGAL::to_double(v->point().y()));
+	zmin = std::min(zmin, CGAL::to_double(v->point().z()));
+  }
+
+  std::ostringstream key;
+  key << nef.number_of_vertices() << ',' << nef.number_of_facets() << ','
+	<< std::llround(xmin * 1000) << ',' << std::llround(ymin * 1000) << ',' << std::llround(zmin * 1000);
+  return key.str();
+}
+
+
+
+/*
+* convex hull of the points translated by the 8 corners of the cube [0, size]^3
+* i.e. minkowski sum of a convex set and the cube
+*/
+bool expanded_hull(const std::vector<Point_3>& points, double size, Nef_polyhedron& expanded)
+{
+  std::vector<Point_3> offset_points;
+  offset_points.reserve(points.size() * 8);
+  for (const auto& p : points)
+	for (int corner = 0; corner != 8; ++corner) {
+	  offset_points.push_back(p + Kernel::Vector_3(
+		(corner & 1) ? size : 0,
+		(corner & 2) ? size : 0,
+		(corner & 4) ? size : 0));
+	}
+
+  Polyhedron hull;
+  CGAL::convex_hull_3(offset_points.begin(), offset_points.end(), hull);
+  if (!hull.is_closed())return false;
+  expanded = Nef_polyhedron(hull);
+  return true;
+}
+
+
+
+/*
+* SNAPPED rung: snap the vertices of the nef to the grid and expand
+* the facets are triangulated first (the facets of a nef are maximal, moving their vertices makes them non-planar)
+* the rung fails if a triangle degenerates by the snapping
+*/
+bool expand_snapped(const Nef_polyhedron& nef, double size, Nef_polyhedron& expanded)
+{
+  if (!nef.is_simple())return false;
+
+  Polyhedron polyhedron;
+  nef.convert_to_polyhedron(polyhedron);
+  CGAL::Polygon_mesh_processing::triangulate_faces(polyhedron);
+  for (auto v = polyhedron.vertices_begin(); v != polyhedron.vertices_end(); ++v) {
+	const Point_3& p = v->point();
+	v->point() = Point_3(
+	  std::round(CGAL::to_double(p.x()) / snap_grid) * snap_grid,
+	  std::round(CGAL::to_double(p.y()) / snap_grid) * snap_grid,
+	  std::round(CGAL::to_double(p.z()) / snap_grid) * snap_grid);
+  }
+  if (!polyhedron.is_closed())return false;
+  for (auto f = polyhedron.facets_begin(); f != polyhedron.facets_end(); ++f) {
+	auto h = f->facet_begin();
+	const Point_3& a = h->vertex()->point();
+	const Point_3& b = (++h)->vertex()->point();
+	const Point_3& c = (++h)->vertex()->point();
+	if (CGAL::collinear(a, b, c))return false;
+  }
+
+  Nef_polyhedron snapped_nef(polyhedron);
+  expanded = NefProcessing::minkowski_sum(snapped_nef, size);
+  return true;
+}
+
+
+
+/*
+* LOD1 rung: the ground faces (lowest faces) of the nef are extruded to the highest point of the nef
+* each triangle of the ground faces gives a convex prism, expanded by expanded_hull()
+* the union of the expanded prisms is the expanded stand-in (minkowski sum distributes over union)
+*/
+bool expand_lod1(const Nef_polyhedron& nef, double size, Nef_polyhedron& expanded)
+{
+  double zmin = 1e12, zmax = -1e12;
+  Nef_polyhedron::Vertex_const_iterator v;
+  for (v = nef.vertices_begin(); v != nef.vertices_end(); ++v) {
+	zmin = std::min(zmin, CGAL::to_double(v->point().z()));
+	zmax = std::max(zmax, CGAL::to_double(v->point().z()));
+  }
+  if (zmax - zmin < epsilon)return false;
+
+  std::vector<Nef_polyhedron> prisms;
+  Nef_polyhedron::Halffacet_const_iterator f;
+  CGAL_forall_halffacets(f, nef)
+  {
+	if (!f->incident_volume()->mark())continue; // each facet once, from the inside
+
+	// rings of the facet
+	std::vector<Point_3> vertices;
+	Face face;
+	bool ground = true;
+	Nef_polyhedron::Halffacet_cycle_const_iterator it;
+	for (it = f->facet_cycles_begin(); it != f->facet_cycles_end() && ground; ++it) {
+	  if (!it.is_shalfedge())continue;
+	  face.rings.emplace_back();
+	  Nef_polyhedron::SHalfedge_const_handle she = Nef_polyhedron::SHalfedge_const_handle(it);
+	  Nef_polyhedron::SHalfedge_around_facet_const_circulator hc_start = she;
+	  Nef_polyhedron::SHalfedge_around_facet_const_circulator hc_end = hc_start;
+	  CGAL_For_all(hc_start, hc_end)
+	  {
+		const Point_3& p = hc_start->source()->center_vertex()->point();
+		if (std::abs(CGAL::to_double(p.z()) - zmin) > epsilon) {
+		  ground = false;
+		  break;
+		}
+		face.rings.back().indices.push_back((unsigned long)vertices.size());
+		vertices.push_back(p);
+	  }
+	}
+	if (!ground || face.rings.empty())continue;
+
+	// triangles of the facet
+	std::vector<std::vector<unsigned long>> triangles;
+	if (!Build::triangulate_face_with_holes(vertices, face, triangles)) {
+	  const auto& ring = face.rings.front().indices;
+	  for (std::size_t i = 1; i + 1 < ring.size(); ++i)triangles.push_back({ ring[0], ring[i], ring[i + 1] });
+	}
+
+	for (const auto& triangle : triangles) {
+	  std::vector<Point_3> points;
+	  for (auto index : triangle) {
+		points.push_back(vertices[index]);
+		points.push_back(Point_3(vertices[index].x(), vertices[index].y(), zmax));
+	  }
+	  prisms.emplace_back();
+	  if (!expanded_hull(points, size, prisms.back()))prisms.pop_back();
+	}
+  }
+  if (prisms.empty())return false;
+
+  expanded = NefProcessing::balanced_union(prisms);
+  return true;
+}
+
+
+
+/*
+* run one rung, may throw
+* the nef is not changed: minkowski_sum() decomposes its operand in place, the later rungs need the original facets
+*/
+bool run_rung(Rung rung, const Nef_polyhedron& nef, double size, Nef_polyhedron& expanded)
+{
+  switch (rung) {
+  case Rung::DIRECT: {
+	Nef_polyhedron working_nef = NefProcessing::copy_nef(nef);
+	expanded = NefProcessing::minkowski_sum(working_nef, size);
+	return true;
+  }
+  case Rung::SNAPPED:
+	return expand_snapped(nef, size, expanded);
+  case Rung::PERTURBED: {
+	Nef_polyhedron working_nef = NefProcessing::copy_nef(nef);
+	expanded = NefProcessing::minkowski_sum(working_nef, size * (1 + perturbation));
+	return true;
+  }
+  case Rung::DECOMPOSITION:
+	expanded = NefProcessing::minkowski_sum_decomposition(nef, size);
+	return true;
+  case Rung::LOD1:
+	return expand_lod1(nef, size, expanded);
+  case Rung::HULL: {
+	Nef_polyhedron convex_nef;
+	if (!NefProcessing::get_convex_nef(nef, convex_nef))return false;
+	expanded = NefProcessing::minkowski_sum(convex_nef, size);
+	return true;
+  }
+  default:
+	return false;
+  }
+}
+
+
+
+/*
+* job of the worker processes: params = { rung, size }
+*/
+int rung_job = Workers::add_job([](const Nef_polyhedron& nef, const std::vector<double>& params, Nef_polyhedron& result) {
+  return run_rung((Rung)(int)params[0], nef, params[1], result);
+});
+
+
+
+/*
+* try one rung within the time budget, see Budget::run()
+*/
+Rung_status try_rung(Rung rung, const Nef_polyhedron& nef, double size, Nef_polyhedron& expanded)
+{
+  return Budget::run(rung_job, nef, { (double)(int)rung, size }, time_budget, expanded);
+}
+
+
+
+/*
+* expand a nef with the ladder
+* starts at the recorded rung of the nef (if any) and climbs down until one rung succeeds
+*
+* @param:
+* nef            : the nef to be expanded
+* minkowski_param: the cube's side length
+* expanded       : the expanded nef
+* used           : if not null, set to the rung which succeeded (FAILED if all rungs failed)
+* @return:
+* false if all rungs failed
+*/
+bool expand(const Nef_polyhedron& nef, double minkowski_param, Nef_polyhedron& expanded, Rung* used = nullptr)
+{
+  std::string key = get_key(nef);
+
+  // start at the recorded rung
+  std::size_t first = 0;
+  {
+	std::lock_guard<std::mutex> lock(records_mutex);
+	auto found = known_rungs.find(key);
+	if (found != known_rungs.end()) {
+	  for (std::size_t i = 0; i != rungs.size(); ++i) {
+		if (rungs[i] == found->second)first = i;
+	  }
+	}
+  }
+
+  for (std::size_t i = first; i != rungs.size(); ++i) {
+	Rung_status status = try_rung(rungs[i], nef, minkowski_param, expanded);
+
+	if (status == Rung_status::SUCCESS) {
+	  if (i != 0)std::cout << "ladder: rung " << rung_string(rungs[i]) << " succeeded\n";
+	  if (used != nullptr)*used = rungs[i];
+	  std::lock_guard<std::mutex> lock(records_mutex);
+	  records[key] = rungs[i];
+	  return true;
+	}
+
+	std::cout << "ladder: rung " << rung_string(rungs[i]) << " " << Budget::status_string(status) << '\n';
+	if (status == Rung_status::TIMED_OUT || status == Rung_status::CRASHED) { // killed worker process, see Budget::log()
+	  Budget::log(key + " (" + rung_string(rungs[i]) + ")", status, i + 1 != rungs.size() ? "rung " + rung_string(rungs[i + 1]) : "nothing");
+	}
+  }
+
+  if (used != nullptr)*used = Rung::FAILED;
+  std::lock_guard<std::mutex> lock(records_mutex);
+  records[key] = Rung::FAILED;
+  return false;
+}
+
+
+
+/*
+* read the records of a previous run
+* one record per line: key	rung
+* return false if the file can not be opened
+*/
+bool read_records(const std::string& filename)
+{
+  std::ifstream in(filename);
+  if (!in.is_open())return false;
+
+  std::lock_guard<std::mutex> lock(records_mutex);
+  std::string key, s;
+  while (in >> key >> s) {
+	Rung rung;
+	if (get_rung(s, rung) && rung != Rung::FAILED)known_rungs[key] = rung;
+  }
+  std::cout << "ladder: " << known_rungs.size() << " records read from " << filename << '\n';
+  return true;
+}
+
+
+
+/*
+* write the records of this run (and the known records which are not used in this run)
+* return false if the file can not be opened
+*/
+bool write_records(const std::string& filename)
+{
+  std::ofstream out(filename);
+  if (!out.is_open()) {
+	std::cerr << "Error: Unable to open ladder records \"" << filename << "\" for writing!" << std::endl;
+	return false;
+  }
+
+  std::lock_guard<std::mutex> lock(records_mutex);
+  std::map<std::string, Rung> all_records(known_rungs);
+  for (const auto& record : records)all_records[record.first] = record.second;
+  for (const auto& record : all_records) {
+	out << record.first << '\t' << rung_string(record.second) << '\n';
+  }
+
+  std::size_t fallbacks = 0;
+  for (const auto& record : records) {
+	if (record.second != Rung::DIRECT)++fallbacks;
+  }
+  std::cout << "ladder: " << records.size() << " nefs expanded, " << fallbacks << " not on the direct rung\n";
+  std::cout << "records saved at: " << filename << '\n';
+  return true;
+}
+
+
+};
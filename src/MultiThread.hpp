@@ -2,12 +2,18 @@
 
 #include <vector>
 #include <functional> // for std::reference_wrapper<T>
-#include <future> // for std::async
-#include <mutex> // for std::mutex
+#include <future> // for std::future
+#include <atomic> // for the completion flags
+#include <numeric> // for std::iota
 #include <chrono> // for Timer
 #include <thread> // for std::this_thread::sleep_for(seconds(5));
 
 #include "Polyhedron.hpp"
+#include "Ladder.hpp"
+#include "Cost.hpp"
+#include "Budget.hpp"
+#include "ThreadPool.hpp"
+#include "Executor.hpp"
 #include "JsonHandler.hpp"
 
 
@@ -15,9 +21,7 @@ using namespace std::chrono;
 
 
 // Timer class -> used for tracking the run time
-//TODO
-//gcc compiler doesn't have overloading of "=" for std::chrono::high_resolution_clock::now()
-//if compiled using gcc/g++ this might need to be changed
+// steady_clock: high_resolution_clock is not steady_clock with gcc/g++, its time_point can not be assigned
 struct Timer //for counting the time
 {
   std::chrono::time_point<std::chrono::steady_clock>start, end;
@@ -25,14 +29,14 @@ struct Timer //for counting the time
 
   Timer() //set default value
   {
-	start = std::chrono::high_resolution_clock::now();
-	end = std::chrono::high_resolution_clock::now();
+	start = std::chrono::steady_clock::now();
+	end = std::chrono::steady_clock::now();
 	duration = end - start;
   }
 
   ~Timer() // get the end value and print the duration time
   {
-	end = std::chrono::high_resolution_clock::now();
+	end = std::chrono::steady_clock::now();
 	duration = end - start;
 
 	std::cout << "Time: " << duration.count() << "s\n";
@@ -56,72 +60,163 @@ struct Timer //for counting the time
 * and pointers should be avoided as much as possible when using CGAL
 * 
 * pass the CGAL object as function parameters with references
-* for std::async(), pass the pointers whenever possible?
+* for the tasks of the thread pool, pass the pointers whenever possible?
 * 
 * since building Nef_polyhedron is relatively fast
 * we build the nefs first and then multi thread the minkowski sum process
+* 
+* all parallel stages submit their tasks to one fixed-size thread pool (see get_pool())
+* thus at most MT::threads tasks run at the same time
+* the stages can be nested: a block task submits its building tasks and waits for them,
+* the waiting worker only runs pending tasks of its own group (its own buildings) meanwhile, never another block
 */
 namespace MT {
 
 
-std::vector<std::future<void>> futures; // store the return value of std::async, necessary step to make async work
-std::mutex nef_mutex; // for thread-safety
+std::size_t threads = 0; // number of worker threads, 0 -> std::thread::hardware_concurrency()
+std::size_t max_failures = 0; // abandon a block when this many minkowski sums failed, 0 -> never
+
+
+
+/*
+* result slot of one asynchronous task
+* each task writes its own pre-allocated slot (index = input position), thus no lock is needed
+* and the order of the results does not depend on which task finishes first
+*
+* done is set after the result is written (release), a stage reading a slot with done == true (acquire)
+* sees the complete result, thus finished slots can be used before all tasks are done
+*/
+struct Slot
+{
+  Nef_polyhedron nef;
+  bool expanded = false; // false if the nef is skipped
+  std::atomic<bool> done{ false };
+};
+
+
+
+/*
+* get the thread pool shared by all parallel stages
+* created at the first call with MT::threads workers
+*/
+ThreadPool& get_pool()
+{
+  static ThreadPool pool(threads);
+  return pool;
+}
+
+
+
+/*
+* job of the worker processes: minkowski sum with the cube, params = { minkowski_param }
+*/
+int minkowski_job = Workers::add_job([](const Nef_polyhedron& nef, const std::vector<double>& params, Nef_polyhedron& result) {
+  Nef_polyhedron working_nef(nef); // minkowski_sum() takes a non-const reference
+  result = NefProcessing::minkowski_sum(working_nef, params[0]);
+  return true;
+});
+
+
+
+/*
+* expand a nef within the budget (Budget::seconds) and / or in a worker process (Budget::isolate)
+* minkowski sum runs in a worker process (see Budget::run()), a crashed task is tried again (Budget::retries times)
+* if it exceeds the budget, fails or keeps crashing, the convex hull of the nef is expanded instead and the replacement is logged
+* (with Budget::isolate the hull is expanded in a worker process as well)
+*
+* @return:
+* SUCCESS, TIMED_OUT / FALLBACK (replaced by the hull), FAILED if neither the nef nor its convex hull can be expanded
+*/
+Task_status expand_nef_within_budget(
+	const Nef_polyhedron& nef,
+	Nef_polyhedron& expanded_nef,
+	double minkowski_param)
+{
+  Budget::Status status = Budget::Status::FAILED;
+  for (unsigned attempt = 0; ; ++attempt) {
+	status = Budget::run(minkowski_job, nef, { minkowski_param }, Budget::seconds, expanded_nef);
+	if (status != Budget::Status::CRASHED || attempt == Budget::retries)break;
+	std::cout << "budget: " << Ladder::get_key(nef) << " crashed, try again\n";
+  }
+  if (status == Budget::Status::SUCCESS)return Task_status::SUCCESS;
+
+  // degrade to the convex hull, minkowski sum of a convex nef does not need a decomposition
+  Nef_polyhedron convex_nef;
+  if (!NefProcessing::get_convex_nef(nef, convex_nef))return Task_status::FAILED;
+  if (Budget::run(minkowski_job, convex_nef, { minkowski_param }, 0, expanded_nef) != Budget::Status::SUCCESS) { // no budget for the hull
+	return Task_status::FAILED;
+  }
+  Budget::log(Ladder::get_key(nef), status, "hull");
+  return status == Budget::Status::TIMED_OUT ? Task_status::TIMED_OUT : Task_status::FALLBACK;
+}
 
 
 /*
 * use minkowski sum to expand a nef
-* add the expanded nef to expanded_nefs vector (via pointer)
+* write the expanded nef to its result slot (via pointer)
 *
 * @ param:
 *
 * @ nef:
 * nef which will be expanded, it's a CGAL object, thus we pass it using reference as a parameter
+* it is changed as in expand_nef(), the callers do not use it afterwards
 *
-* @ expanded_nefs:
-* a vector to store the expanded nefs, for using std::async(), we pass the pointer of the vector
+* @ slot:
+* the result slot of this nef, for using the thread pool, we pass the pointer of the slot
 *
 * @ minkowski_param:
 * the "minkowski parameter"
 * minkowski sums two nefs, we define a small cube with side length = minkowski_param
 * and we expand the nef with this cube
 * the minkowski_param is set to 0.1 by default
+*
+* @ return:
+* the status of the task (see Task_status), an exception is passed on to the caller (e.g. reported by the Executor)
+* the slot is marked as done in any case
 */
-void expand_nef_async(
+Task_status expand_nef_async(
 	Nef_polyhedron& nef,
-	std::vector<Nef_polyhedron>* expanded_nefs_Ptr,
+	Slot* slot,
 	double minkowski_param)
 {
   // check the pointer
-  if (expanded_nefs_Ptr == nullptr) {
-	std::cerr << "pointer of expanded_nefs vector is null, please check " << std::endl;
-	return;
+  if (slot == nullptr) {
+	std::cerr << "pointer of the result slot is null, please check " << std::endl;
+	return Task_status::FAILED;
   }
 
-  // perform minkowski operation
-  //TODO
-  //try/catch with mutex ... ?
+  Task_status status = Task_status::FAILED;
   try{
-	Nef_polyhedron expanded_nef = NefProcessing::minkowski_sum(nef, minkowski_param);
-	std::lock_guard<std::mutex> lock(nef_mutex); // lock the meshes to avoid conflict
-	expanded_nefs_Ptr->emplace_back(expanded_nef);
-  }catch(CGAL::Assertion_exception e){
+	if (Ladder::enabled()) { // retry ladder, if set
+	  Ladder::Rung rung = Ladder::Rung::FAILED;
+	  if (Ladder::expand(nef, minkowski_param, slot->nef, &rung)) {
+		status = (rung == Ladder::Rung::DIRECT) ? Task_status::SUCCESS : Task_status::FALLBACK;
+	  }
+	}
+	else if (Budget::seconds > 0 || Budget::isolate) { // time budget or worker process, if set
+	  status = expand_nef_within_budget(nef, slot->nef, minkowski_param);
+	}
+	else { // perform minkowski operation
+	  slot->nef = NefProcessing::minkowski_sum(nef, minkowski_param);
+	  status = Task_status::SUCCESS;
+	}
+  }catch(...){
 	// inside catch can not process the nef
-	std::cerr << "CGAL error" << '\n';
 	std::cout << "the nef will be skipped\n";
+	slot->done.store(true, std::memory_order_release);
+	throw;
   }
 
-//  Nef_polyhedron expanded_nef = NefProcessing::minkowski_sum(nef, minkowski_param);
-//
-//  // using a local lock_guard to lock mtx guarantees unlocking on destruction / exception:
-//  std::lock_guard<std::mutex> lock(nef_mutex); // lock the meshes to avoid conflict
-//  expanded_nefs_Ptr->emplace_back(expanded_nef);
-
+  slot->expanded = (status != Task_status::FAILED);
+  if (!slot->expanded)std::cout << "the nef will be skipped\n";
+  slot->done.store(true, std::memory_order_release);
+  return status;
 }
 
 
 /*
 * expand nefs asynchronously
-* will call std::async() and expand_nef_async() function
+* will submit expand_nef_async() to the thread pool for each nef
 *
 * @ param:
 *
@@ -130,48 +225,129 @@ void expand_nef_async(
 *
 * @ expanded_nefs:
 * a vector which contains the expanded nef polyhedra
-* to use std::async() we need to pass pointers whenever possible
-* but we need to avoid to use the pointer pointing to CGAL objects
+* the expanded nefs are added in the order of nefs (skipped nefs are left out), independent of the timing
 *
 * @ minkowski_param:
 * the "minkowski parameter"
 * minkowski sums two nefs, we define a small cube with side length = minkowski_param
 * and we expand the nef with this cube
 * the minkowski_param is set to 0.1 by default
+*
+* @ return:
+* false if the block is abandoned (MT::max_failures minkowski sums failed), expanded_nefs holds the finished nefs then
 */
-void expand_nefs_async(
+bool expand_nefs_async(
 	std::vector<Nef_polyhedron>& nefs,
 	std::vector<Nef_polyhedron>& expanded_nefs,
 	double minkowski_param = 0.1)
 {
 
   /*
-  * call std::async() to enable asynchronous process
-  * it is important to save the result of std::async()
-  * to enable the async process
+  * submit one task for each nef to an executor of this block
+  * at most get_pool().size() nefs are expanded at the same time
+  * each task writes the slot of its nef, the executor keeps the status and the run time of each task
   *
   * do not use const qualifier - the nef will be changed
   * and use reference in the for loop
+  *
+  * if the cost model is enabled, the nefs are submitted longest-first
+  * and the run time of each task is recorded
   */
-  for (auto& nef : nefs) {
-	//auto futureobj = std::async(std::launch::async, expand_nef_async, nef, &expanded_nefs, minkowski_param);
-	futures.emplace_back(
-		std::async(
-			std::launch::async, /* launch policy */
-			expand_nef_async, /* function will be called asynchronously */
-			nef, /* arguments - a nef */
-			&expanded_nefs, /* arguments - pointer to expanded_nefs vector */
-			minkowski_param /* arguments - minkowski_param (default is 0.1)*/
-		));
+  ThreadPool& pool = get_pool();
+  std::vector<Cost::Features> features;
+  std::vector<std::size_t> order(nefs.size());
+  if (Cost::enabled)order = Cost::schedule(nefs, features, &pool); // the features are computed in the pool
+  else std::iota(order.begin(), order.end(), 0);
+
+  std::vector<Slot> slots(nefs.size());
+  Executor executor(pool, max_failures);
+  for (auto i : order) {
+	executor.submit(
+		"nef " + std::to_string(i),
+		[&nefs, &slots, &features, minkowski_param, i]() { /* the nef is passed by reference, not copied */
+		  auto start = std::chrono::steady_clock::now();
+		  Task_status status = expand_nef_async(nefs[i], &slots[i], minkowski_param);
+		  if (Cost::enabled)Cost::record(features[i], std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		  return status;
+		});
   }
 
   /*
-  * if we wish to get the result value and keep processing
-  * we need to use get() of every future object
+  * wait for all tasks before the expanded nefs are used
+  * a waiting worker runs pending tasks of the executor meanwhile
   */
-  for (auto& futureObject : futures) {
-	futureObject.get();
+  executor.wait();
+  executor.print_summary("minkowski sums");
+
+  // collect the slots in the input order
+  for (auto& slot : slots) {
+	if (slot.done.load(std::memory_order_acquire) && slot.expanded)expanded_nefs.emplace_back(std::move(slot.nef));
+  }
+  return !executor.cancelled();
+}
+
+
+
+/*
+* build nefs asynchronously
+* one task for each building is submitted to the thread pool
+*
+* each building gets its own result vector, thus no lock is needed
+* and the nefs are added to nefs in the order of jhandles (as Build::build_nef_polyhedron() one by one)
+*/
+void build_nefs_async(
+	const std::vector<JsonHandler>& jhandles,
+	std::vector<Nef_polyhedron>& nefs,
+	const Build_options& options)
+{
+  ThreadPool& pool = get_pool();
+  std::vector<std::vector<Nef_polyhedron>> building_nefs(jhandles.size());
+
+  std::vector<std::future<void>> futures;
+  futures.reserve(jhandles.size());
+  for (std::size_t i = 0; i != jhandles.size(); ++i) {
+	futures.emplace_back(pool.submit([&jhandles, &building_nefs, &options, i]() {
+	  Build::build_nef_polyhedron(jhandles[i], building_nefs[i], options);
+	}, &futures)); // the futures identify the group, see ThreadPool::wait()
+  }
+  pool.wait_all(futures, &futures);
+
+  for (auto& building : building_nefs) {
+	for (auto& nef : building)nefs.emplace_back(std::move(nef));
+  }
+}
+
+
+
+/*
+* union nefs asynchronously
+* it's the parallel version of NefProcessing::balanced_union():
+* the pairs of one level are merged in parallel, then pairs of pairs, and so on
+* thus the union has log depth and each union has smaller operands than the sequential big_nef += nef
+*
+* each pair task only changes nefs[i] and reads nefs[i + step], the pairs of one level do not overlap,
+* thus no lock is needed, the next level starts when all pairs of the level are done
+*
+* @param
+* nefs: the nefs to be merged, will be changed (used as the working space)
+* @return
+* the union of all nefs
+*/
+Nef_polyhedron union_nefs_async(std::vector<Nef_polyhedron>& nefs)
+{
+  if (nefs.empty())return Nef_polyhedron();
+
+  ThreadPool& pool = get_pool();
+  for (std::size_t step = 1; step < nefs.size(); step *= 2) {
+	std::vector<std::future<void>> futures;
+	for (std::size_t i = 0; i + step < nefs.size(); i += 2 * step) {
+	  futures.emplace_back(pool.submit([&nefs, i, step]() {
+		nefs[i] += nefs[i + step];
+	  }, &futures));
+	}
+	pool.wait_all(futures, &futures);
   }
+  return nefs[0];
 }
 
 
@@ -184,6 +360,10 @@ void expand_nefs_async(
 * expand a nef
 * it's the synchronous version of expand_nef_async()
 * used for not performing multi threading
+*
+* the nef is changed: the cgal engine decomposes it in place (see NefProcessing::minkowski_sum()),
+* the callers do not use it afterwards (only the hull fallback below, which only needs its vertices)
+* a nef which is used again must be copied with NefProcessing::copy_nef() first
 */
 void expand_nef(
 	Nef_polyhedron& nef,
@@ -197,10 +377,31 @@ void expand_nef(
 	return;
   }
 
-  // before peroforming minkowski operation, make a copy of nef
-  // since if an exception was shrown, it is not possible to use nef in the catch block
-  Nef_polyhedron nef_copy(nef);
-  std::cout << "make copy\n";
+  // retry ladder, if set
+  if (Ladder::enabled()) {
+	Nef_polyhedron expanded_nef;
+	if (Ladder::expand(nef, minkowski_param, expanded_nef)) {
+	  expanded_nefs_Ptr->emplace_back(expanded_nef);
+	}
+	else {
+	  std::cout << "the nef will be skipped\n";
+	}
+	std::cout << "done\n";
+	return;
+  }
+
+  // time budget or worker process, if set
+  if (Budget::seconds > 0 || Budget::isolate) {
+	Nef_polyhedron expanded_nef;
+	if (expand_nef_within_budget(nef, expanded_nef, minkowski_param) != Task_status::FAILED) {
+	  expanded_nefs_Ptr->emplace_back(expanded_nef);
+	}
+	else {
+	  std::cout << "the nef will be skipped\n";
+	}
+	std::cout << "done\n";
+	return;
+  }
 
   // perform minkowski operation
   try{
@@ -211,16 +412,11 @@ void expand_nef(
 	// inside catch can not process the nef
 	std::cerr << "CGAL error" << '\n';
 
-	// first get the geometry
-	std::vector<Shell_explorer> shell_explorers;
-	NefProcessing::extract_nef_geometries(nef_copy, shell_explorers);
-
-	Shell_explorer se = shell_explorers[0]; // shell representing for exterior
-	Polyhedron convex_polyhedron;
-	CGAL::convex_hull_3(se.vertices.begin(), se.vertices.end(), convex_polyhedron);
-
-	if(convex_polyhedron.is_closed()){
-	  Nef_polyhedron convex_nef(convex_polyhedron);
+	// the convex hull is built from the vertices of the nef
+	// no copy of the nef is needed, the convex decomposition inside minkowski sum only adds facets inside the solid
+	// thus the convex hull of the vertices is not changed
+	Nef_polyhedron convex_nef;
+	if(NefProcessing::get_convex_nef(nef, convex_nef)){
 	  Nef_polyhedron expanded_convex_nef = NefProcessing::minkowski_sum(convex_nef, minkowski_param);
 	  expanded_nefs_Ptr->emplace_back(expanded_convex_nef);
 	  std::cout << "build the convex hull of the nef and then expand\n";
@@ -244,14 +440,20 @@ void expand_nefs(
 	std::vector<Nef_polyhedron>& expanded_nefs,
 	double minkowski_param = 0.1)
 {
+  // the cost model only records the run time here, the order does not change the total time of one thread
+  std::vector<Cost::Features> features;
+  if (Cost::enabled)Cost::schedule(nefs, features);
+
   // expand each nef in nefs vector
-  for (auto& nef : nefs) {
+  for (std::size_t i = 0; i != nefs.size(); ++i) {
+	auto start = std::chrono::steady_clock::now();
 	try{
-	  expand_nef(nef, &expanded_nefs, minkowski_param);
+	  expand_nef(nefs[i], &expanded_nefs, minkowski_param);
 	}catch(...){
 	  std::cerr << "expand nef error\n";
 	  continue;
 	}
+	if (Cost::enabled)Cost::record(features[i], std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
 
   }
 }
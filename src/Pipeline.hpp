@@ -0,0 +1,299 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <tuple>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "JsonHandler.hpp"
+#include "Polyhedron.hpp"
+#include "MultiThread.hpp"
+
+
+
+/*
+* class for processing one block as a streaming pipeline: parse -> build -> expand -> union
+*
+* in the staged flow each stage finishes for all buildings before the next one starts,
+* the union can not begin until the slowest minkowski sum is done
+* and jhandles, nefs and expanded_nefs of all buildings are held in memory at the same time
+*
+* in the pipeline each building flows through the stages on its own:
+* parse        : in the calling thread, one building after another
+* build+expand : one task for each building in the thread pool (see MT::get_pool()), run by an Executor of the pipeline:
+*                the status of each building is reported and the block is abandoned after MT::max_failures failed buildings
+* union        : in the calling thread, the expanded nefs are merged as they arrive
+*
+* at most capacity buildings are between parse and union (the queue is bounded),
+* the parse stage waits (a worker runs pending build+expand tasks of this pipeline meanwhile, never other tasks of the pool)
+* until the union has consumed one, thus the intermediates are freed as soon as they are consumed
+*
+* the arriving nefs are merged like a binary counter: two partial unions of the same size are merged,
+* thus the operands stay balanced as in NefProcessing::balanced_union()
+* the merge order depends on the completion order of the tasks (the result is the same set),
+* unless ordered is set: the nefs are then merged in the input order (a building arriving early is held back)
+*
+* usage:
+* Pipeline pipeline(capacity, ordered, print_info);                               // 0 -> twice the number of threads
+* bool complete = pipeline.run(j, adjacency, lod, datum, build_options, minkowski_param, big_nef);
+*/
+class Pipeline
+{
+public:
+
+	/*
+	* @param:
+	* capacity  : maximum number of buildings between parse and union, 0 -> twice the number of threads
+	* ordered   : merge in the input order, for deterministic output
+	* print_info: print the info of each parsed building (see JsonHandler::message())
+	*/
+	Pipeline(std::size_t capacity = 0, bool ordered = false, bool print_info = false)
+		: capacity(capacity), ordered(ordered), print_info(print_info) {}
+
+
+
+	/*
+	* run the pipeline for the buildings of one block
+	*
+	* @param:
+	* j              : the cityjson file
+	* building_names : the buildings of the block
+	* lod, datum     : see JsonHandler::read_certain_building()
+	* options        : see Build_options
+	* minkowski_param: see MT::expand_nef_async()
+	* big_nef        : the union of the expanded nefs
+	* @return:
+	* false if the block is abandoned (MT::max_failures buildings failed), big_nef holds the merged buildings then
+	*/
+	bool run(
+		const json& j,
+		const std::vector<std::string>& building_names,
+		double lod,
+		std::tuple<double, double, double>& datum,
+		const Build_options& options,
+		double minkowski_param,
+		Nef_polyhedron& big_nef)
+	{
+		ThreadPool& pool = MT::get_pool();
+		std::size_t bound = capacity == 0 ? 2 * pool.size() : capacity;
+
+		Queue queue;
+		Executor executor(pool, MT::max_failures); // the tasks of this pipeline, see pop()
+
+		partial_unions.clear();
+		held.clear();
+		in_flight = 0;
+		next_index = 0;
+		expanded_count = 0;
+
+		if (print_info)std::cout << "------------------------ building(part) info ------------------------\n";
+		for (std::size_t index = 0; index != building_names.size() && !executor.cancelled(); ++index) {
+			const std::string& building_name = building_names[index];
+
+			// parse
+			JsonHandler jhandle;
+			jhandle.read_certain_building(j, building_name, lod, datum);
+			if (print_info)jhandle.message();
+
+			// wait for a free place in the pipeline, merge what has arrived meanwhile
+			Item item;
+			while (in_flight >= bound && pop(queue, pool, executor, item)) {
+				receive(std::move(item));
+			}
+			if (executor.cancelled())break;
+
+			// build + expand, the status of the building is the worst status of its nefs
+			executor.submit("building " + building_name, [jhandle = std::move(jhandle), index, &queue, &options, minkowski_param]() {
+				std::vector<Nef_polyhedron> expanded_nefs;
+				Task_status status = Task_status::SUCCESS;
+				try {
+					std::vector<Nef_polyhedron> nefs;
+					if (!Build::build_nef_polyhedron(jhandle, nefs, options))status = Task_status::FAILED;
+					for (auto& nef : nefs) {
+						MT::Slot slot;
+						Task_status nef_status = MT::expand_nef_async(nef, &slot, minkowski_param);
+						if (slot.expanded)expanded_nefs.emplace_back(std::move(slot.nef));
+						if (severity(nef_status) > severity(status))status = nef_status;
+					}
+				}
+				catch (...) {
+					push(queue, Item(index, std::move(expanded_nefs))); // the union still counts the building
+					throw; // reported by the executor
+				}
+
+				// always push (possibly nothing), the union counts one item for each building
+				push(queue, Item(index, std::move(expanded_nefs)));
+				return status;
+			});
+			++in_flight;
+
+			// union what has already arrived, without waiting
+			while (try_pop(queue, item)) {
+				receive(std::move(item));
+			}
+		}
+
+		// drain, a cancelled building never arrives
+		Item item;
+		while (in_flight != 0 && pop(queue, pool, executor, item)) {
+			receive(std::move(item));
+		}
+		executor.wait();
+		while (try_pop(queue, item)) { // arrived after the cancellation
+			receive(std::move(item));
+		}
+		if (print_info)std::cout << "---------------------------------------------------------------------\n";
+
+		executor.print_summary("pipeline");
+		std::cout << "pipeline: " << building_names.size() << " buildings, " << expanded_count << " expanded nefs merged\n";
+		big_nef = finish();
+		return !executor.cancelled();
+	}
+
+
+
+protected:
+
+	/*
+	* queue between expand and union, bounded by the number of buildings in flight
+	*/
+	typedef std::pair<std::size_t, std::vector<Nef_polyhedron>> Item; // (input index, the expanded nefs of one building)
+
+	struct Queue
+	{
+		std::deque<Item> items;
+		std::mutex mutex;
+		std::condition_variable condition;
+	};
+
+
+
+	bool try_pop(Queue& queue, Item& item)
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.items.empty())return false;
+		item = std::move(queue.items.front());
+		queue.items.pop_front();
+		return true;
+	}
+
+
+
+	static void push(Queue& queue, Item item)
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.items.emplace_back(std::move(item));
+		queue.condition.notify_one();
+	}
+
+
+
+	/*
+	* wait for an item, a worker runs pending tasks of this pipeline (of its executor) meanwhile
+	* (the calling thread may be a worker of the pool, e.g. a block task in --all mode,
+	* running another block would leave the items of this pipeline unconsumed and break the capacity bound)
+	* return false if the executor is cancelled and nothing has arrived, the remaining buildings may never arrive
+	*/
+	bool pop(Queue& queue, ThreadPool& pool, Executor& executor, Item& item)
+	{
+		while (!try_pop(queue, item)) {
+			if (executor.cancelled())return false;
+			if (pool.run_pending(&executor))continue; // the executor submits its tasks with itself as the group
+			std::unique_lock<std::mutex> lock(queue.mutex);
+			queue.condition.wait_for(lock, std::chrono::milliseconds(1), [&queue]() { return !queue.items.empty(); });
+		}
+		return true;
+	}
+
+
+
+	/*
+	* order of the statuses of the nefs of one building, the worst one is reported
+	*/
+	static int severity(Task_status status)
+	{
+		switch (status) {
+		case Task_status::SUCCESS: return 0;
+		case Task_status::FALLBACK: return 1;
+		case Task_status::TIMED_OUT: return 2;
+		default: return 3;
+		}
+	}
+
+
+
+	/*
+	* an item arrives at the union stage
+	* ordered: held back until all buildings before it are merged
+	*/
+	void receive(Item item)
+	{
+		if (!ordered) {
+			consume(std::move(item.second));
+			return;
+		}
+
+		held.emplace(item.first, std::move(item.second));
+		for (auto it = held.find(next_index); it != held.end(); it = held.find(next_index)) {
+			consume(std::move(it->second));
+			held.erase(it);
+			++next_index;
+		}
+	}
+
+
+
+	/*
+	* union stage: merge the arriving nefs like a binary counter
+	* partial_unions holds (partial union, number of merged nefs), the sizes decrease from front to back
+	*/
+	void consume(std::vector<Nef_polyhedron> item)
+	{
+		--in_flight; // the building leaves the pipeline
+		for (auto& nef : item) {
+			partial_unions.emplace_back(std::move(nef), 1);
+			++expanded_count;
+			while (partial_unions.size() >= 2 &&
+				partial_unions[partial_unions.size() - 2].second == partial_unions.back().second) {
+				auto last = std::move(partial_unions.back());
+				partial_unions.pop_back();
+				partial_unions.back().first += last.first;
+				partial_unions.back().second += last.second;
+			}
+		}
+	}
+
+
+
+	/*
+	* merge the remaining partial unions, smallest first
+	*/
+	Nef_polyhedron finish()
+	{
+		if (partial_unions.empty())return Nef_polyhedron();
+		Nef_polyhedron result = std::move(partial_unions.back().first);
+		for (std::size_t i = partial_unions.size() - 1; i-- != 0;) {
+			result += partial_unions[i].first;
+		}
+		partial_unions.clear();
+		return result;
+	}
+
+
+
+protected:
+
+	std::size_t capacity;
+	bool ordered;
+	bool print_info;
+
+	std::vector<std::pair<Nef_polyhedron, std::size_t>> partial_unions;
+	std::map<std::size_t, std::vector<Nef_polyhedron>> held; // ordered: the buildings which arrived before their turn
+	std::size_t in_flight = 0; // buildings submitted but not merged (including the held ones)
+	std::size_t next_index = 0; // ordered: the next building to be merged
+	std::size_t expanded_count = 0;
+};
@@ -3,18 +3,40 @@
 // JsonHandler
 #include "JsonHandler.hpp"
 
+// validity checks
+#include "Validation.hpp"
+
+// pre-screen with inexact kernel
+#include "Prescreen.hpp"
+
 // necessary include files from CGAL
 #include <CGAL/Polyhedron_3.h>
 #include <CGAL/Polyhedron_incremental_builder_3.h>
 #include <CGAL/Nef_polyhedron_3.h>
 #include <CGAL/convex_hull_3.h>
 #include <CGAL/minkowski_sum_3.h>
+#include <CGAL/convex_decomposition_3.h> // for the convex decomposition minkowski engine
 #include <CGAL/boost/graph/graph_traits_Polyhedron_3.h> // for filling holes
 #include <CGAL/Polygon_mesh_processing/triangulate_faces.h> // for triangulating surfaces
 #include <CGAL/Polygon_mesh_processing/triangulate_hole.h> // for filling holes
+#include <CGAL/Polygon_mesh_processing/repair_polygon_soup.h> // for the repair path
+#include <CGAL/Polygon_mesh_processing/repair.h> // for the repair path - removing degenerate faces
 #include <boost/foreach.hpp> // for filling holes
 #include <CGAL/OFF_to_nef_3.h> // for erosion - constructing bbox
 
+#include <map> // for snap rounding
+#include <sstream> // for copy_nef()
+#include <tuple> // for snap rounding
+#include <array> // for the centroids in spatial_order()
+#include <algorithm> // for std::nth_element
+
+// for triangulating faces with holes (inner rings)
+#include <CGAL/Constrained_Delaunay_triangulation_2.h>
+#include <CGAL/Triangulation_vertex_base_with_info_2.h>
+#include <CGAL/Triangulation_face_base_with_info_2.h>
+#include <list>
+#include <set>
+
 // for remeshing
 #include <CGAL/Surface_mesh.h> // for surface_mesh
 #include <CGAL/boost/graph/copy_face_graph.h> // for converting to surface mesh
@@ -42,6 +64,14 @@ typedef boost::graph_traits<Mesh>::edge_descriptor            edge_descriptor;
 
 namespace PMP = CGAL::Polygon_mesh_processing;
 
+// for triangulating faces with holes (inner rings), projected to 2D, inexact kernel is enough since only the indices are used
+struct Hole_face_info { int nesting_level = -1; bool in_domain() const { return nesting_level % 2 == 1; } };
+typedef CGAL::Triangulation_vertex_base_with_info_2<long, Inexact_kernel>                 Hole_vb;
+typedef CGAL::Triangulation_face_base_with_info_2<Hole_face_info, Inexact_kernel>         Hole_fbi;
+typedef CGAL::Constrained_triangulation_face_base_2<Inexact_kernel, Hole_fbi>             Hole_fb;
+typedef CGAL::Triangulation_data_structure_2<Hole_vb, Hole_fb>                            Hole_tds;
+typedef CGAL::Constrained_Delaunay_triangulation_2<Inexact_kernel, Hole_tds, CGAL::Exact_predicates_tag> Hole_CDT;
+
 
 
 /*
@@ -66,6 +96,22 @@ struct Polyhedron_builder : public CGAL::Modifier_base<HDS> {
 };
 
 
+/*
+* options for building nef polyhedra
+* triangulate: if true, triangulation of surfaces will be performed before building nef
+* prescreen  : if true, each building is screened with an inexact kernel first (see Prescreen.hpp)
+*              and routed to the direct path, the repair path or the fallback (convex hull)
+* snap_grid  : if larger than 0, the vertices are snapped to a grid of this size (e.g. 0.001 -> 1 mm)
+*              before building, tiny coordinate noise otherwise blows up the exact rational sizes
+*/
+struct Build_options
+{
+    bool triangulate = true;
+    bool prescreen = false;
+    double snap_grid = 0;
+};
+
+
 /*
 use CGAL to build polyhedron
 */
@@ -73,109 +119,468 @@ class Build
 {
 public:
 
-    // build one polyhedron using vertices and faces from one shell (one building)
-    // jhandle: A JsonHandler instance, contains all vertices and solids
-    // index  : index of solids vector, indicating which solid is going to be built - ideally one building just contains one solid
-    // triangulate: if true, triangulation of surfaces will be performed before building nef
-    static void build_nef_polyhedron(
-        const JsonHandler& jhandle, 
-        std::vector<Nef_polyhedron>& Nefs,
-        bool triangulate = true,
+    /*
+    * get the vertices and faces of one shell (one building) in a polyhedron_builder
+    * snap rounding is applied here if required by the options
+    * 
+    * @param:
+    * jhandle           : A JsonHandler instance, contains all vertices and solids
+    * polyhedron_builder: will be filled with the vertices and faces
+    * options           : see Build_options
+    * index             : index of solids vector, indicating which solid is going to be built
+    * @return:
+    * false if the solid contains 0 or more than one shells, otherwise true
+    */
+    static bool get_polyhedron_builder(
+        const JsonHandler& jhandle,
+        Polyhedron_builder<Polyhedron::HalfedgeDS>& polyhedron_builder,
+        const Build_options& options = Build_options(),
         unsigned long index = 0)
     {
         const auto& solid = jhandle.solids[index]; // get the solid
 
-        //std::cout << solid.id << '\n';
-
         if (solid.shells.size() != 1) {
             std::cout << "warning: this solid contains 0 or more than one shells\n";
             std::cout << "please check build_one_polyhedron function and check the following solid:\n";
             std::cout << "solid id: " << solid.id << '\n';
             std::cout << "solid lod: " << solid.lod << '\n';
             std::cout << "no polyhedron is built with this solid\n";
+            return false;
         }
-        else {
-            // create a polyhedron and a builder
-            Polyhedron polyhedron;
-            Polyhedron_builder<Polyhedron::HalfedgeDS> polyhedron_builder;
 
-            // add vertices and faces to polyhedron_builder
-            polyhedron_builder.vertices = jhandle.vertices; // now jhandle only handles one building(solid)
-            for (auto const& shell : solid.shells)
-                for (auto const& face : shell.faces)
-                    for (auto const& ring : face.rings)
-                        polyhedron_builder.faces.push_back(ring.indices);
+        // add vertices and faces to polyhedron_builder
+        // a face with inner rings (holes) is triangulated with the holes respected
+        // since Polyhedron_builder only accepts one ring for each facet
+        polyhedron_builder.vertices = jhandle.vertices; // now jhandle only handles one building(solid)
+        for (auto const& shell : solid.shells)
+            for (auto const& face : shell.faces) {
+                if (face.rings.size() > 1 && triangulate_face_with_holes(jhandle.vertices, face, polyhedron_builder.faces))continue;
+                for (auto const& ring : face.rings)
+                    polyhedron_builder.faces.push_back(ring.indices);
+            }
+
+        // snap the vertices to the grid, merge collapsed vertices and drop degenerate faces
+        if (options.snap_grid > 0) {
+            snap_to_grid(polyhedron_builder, options.snap_grid);
+        }
+
+        return true;
+    }
+
+
+    // build one polyhedron using vertices and faces from one shell (one building)
+    // jhandle: A JsonHandler instance, contains all vertices and solids
+    // options: see Build_options
+    // index  : index of solids vector, indicating which solid is going to be built - ideally one building just contains one solid
+    // return : true if a nef polyhedron (or its convex hull) is added to Nefs
+    static bool build_nef_polyhedron(
+        const JsonHandler& jhandle, 
+        std::vector<Nef_polyhedron>& Nefs,
+        const Build_options& options = Build_options(),
+        unsigned long index = 0)
+    {
+        // create a builder
+        Polyhedron_builder<Polyhedron::HalfedgeDS> polyhedron_builder;
+
+        if (!get_polyhedron_builder(jhandle, polyhedron_builder, options, index)) {
+            return false;
+        }
+
+        return build_nef_polyhedron(polyhedron_builder, jhandle.solids[index].id, Nefs, options);
+    }
+
+
+    // build one polyhedron from a filled polyhedron_builder (e.g. modified by Snap after get_polyhedron_builder())
+    // polyhedron_builder: vertices and faces of one building
+    // id                : building id, for prompting info
+    // options           : see Build_options, snap_grid is not applied here (see get_polyhedron_builder())
+    // return            : true if a nef polyhedron (or its convex hull) is added to Nefs
+    static bool build_nef_polyhedron(
+        Polyhedron_builder<Polyhedron::HalfedgeDS>& polyhedron_builder,
+        const std::string& id,
+        std::vector<Nef_polyhedron>& Nefs,
+        const Build_options& options = Build_options())
+    {
+        // create a polyhedron
+        Polyhedron polyhedron;
+
+        // screen the building before any exact polyhedron is built
+        Route route = Route::DIRECT;
+        if (options.prescreen) {
+            Prescreen_result result = Prescreen::screen(polyhedron_builder.vertices, polyhedron_builder.faces);
+            route = result.route;
+            if (route != Route::DIRECT) {
+                std::cout << "pre-screen: " << Prescreen::route_string(route) << " path for building: " << id << '\n';
+            }
+        }
+
+        // broken building, skip the builder and use the convex hull directly
+        if (route == Route::FALLBACK) {
+            return build_convex_nef_polyhedron(polyhedron_builder.vertices, id, Nefs, options.triangulate);
+        }
 
+        if (route == Route::REPAIR) {
+            if (!repair_polyhedron(polyhedron_builder, polyhedron)) {
+                std::cout << "the polygon soup can not be oriented, build convex hull to replace it" << '\n';
+                std::cout << "building id: " << id << '\n';
+                return build_convex_nef_polyhedron(polyhedron_builder.vertices, id, Nefs, options.triangulate);
+            }
+        }
+        else {
             // call the delegate function
             polyhedron.delegate(polyhedron_builder);
             //std::cout << "polyhedron closed? " << polyhedron.is_closed() << '\n';
+        }
 
-            if (polyhedron.is_closed()) {
+        if (polyhedron.is_closed()) {
 
-                // filling holes?
-                // polyhedron_hole_filling(polyhedron);
+            // filling holes?
+            // polyhedron_hole_filling(polyhedron);
 
-                // if triangulation is true, triangulate the surfaces first (lod2.2)
-                if (triangulate) {
-                    CGAL::Polygon_mesh_processing::triangulate_faces(polyhedron);
-                }
+            // if triangulation is true, triangulate the surfaces first (lod2.2)
+            if (options.triangulate) {
+                CGAL::Polygon_mesh_processing::triangulate_faces(polyhedron);
+            }
+
+            // the repair path also removes the degenerate faces (only possible after triangulation)
+            if (route == Route::REPAIR) {
+                CGAL::Polygon_mesh_processing::remove_degenerate_faces(polyhedron);
+            }
+
+            // build nef polyhedron
+            Nef_polyhedron nef_polyhedron(polyhedron);
+            Nefs.emplace_back();
+            Nefs.back() = nef_polyhedron; // add the built nef_polyhedron to the Nefs vector
+            std::cout << "build nef polyhedron" << '\n';
+
+            // is_valid() traverses the whole nef, only perform it when required by the validation level
+            if (Validation::should_check()) {
+                Validation::record("nef is_valid", id, nef_polyhedron.is_valid());
+            }
+            return true;
+        }
+        else {
+            std::cout << "the polyhedron is not closed, build convex hull to replace it" << '\n';
+            std::cout << "building id: " << id << '\n';
+            return build_convex_nef_polyhedron(polyhedron_builder.vertices, id, Nefs, options.triangulate);
+        }
+
+        /* test to write the polyhedron to .off file --------------------------------------------------------*/
+
+        // Write polyhedron in Object File Format (OFF).
+        // CGAL::set_ascii_mode(std::cout);
+        // std::cout << "OFF" << std::endl << polyhedron.size_of_vertices() << ' '
+        //     << polyhedron.size_of_facets() << " 0" << std::endl;
+        // std::copy(polyhedron.points_begin(), polyhedron.points_end(),
+        //     std::ostream_iterator<Point_3>( std::cout, "\n"));
+        // for (Facet_iterator i = polyhedron.facets_begin(); i != polyhedron.facets_end(); ++i) 
+        // {
+        //     Halfedge_facet_circulator j = i->facet_begin();
+        //     // Facets in polyhedral surfaces are at least triangles.
+        //     std::cout << CGAL::circulator_size(j) << ' ';
+        //     do {
+        //         std::cout << ' ' << std::distance(polyhedron.vertices_begin(), j->vertex());
+        //     } while ( ++j != i->facet_begin());
+        //     std::cout << std::endl;
+        // }
+
+        // std::cout<<polyhedron<<std::endl;
+
+    }
 
-                // build nef polyhedron
-                Nef_polyhedron nef_polyhedron(polyhedron);
-                Nefs.emplace_back();
-                Nefs.back() = nef_polyhedron; // add the built nef_polyhedron to the Nefs vector
-                std::cout << "build nef polyhedron" << " ";
-                std::cout << "-> " << (nef_polyhedron.is_valid() ? "valid" : "invalid") << '\n';
-            }
-            else {
-                std::cout << "the polyhedron is not closed, build convex hull to replace it" << '\n';
-                std::cout << "building id: " << solid.id << '\n';
-                Polyhedron convex_polyhedron;
-                CGAL::convex_hull_3(jhandle.vertices.begin(), jhandle.vertices.end(), convex_polyhedron);
-
-                // now check if we successfully build the convex hull
-                if (convex_polyhedron.is_closed()) {
-
-                    // if triangulation is true, triangulate the surfaces first (lod2.2)
-                    if (triangulate) {
-                        CGAL::Polygon_mesh_processing::triangulate_faces(convex_polyhedron);
+
+    /*
+    * build the convex hull of the vertices and convert it to a nef polyhedron
+    * used as the fallback if a building can not be built correctly
+    * 
+    * @param:
+    * vertices   : vertices of the building
+    * id         : building id, for prompting info
+    * Nefs       : the built convex nef polyhedron will be added to Nefs
+    * triangulate: if true, triangulation of surfaces will be performed before building nef
+    */
+    static bool build_convex_nef_polyhedron(
+        const std::vector<Point_3>& vertices,
+        const std::string& id,
+        std::vector<Nef_polyhedron>& Nefs,
+        bool triangulate = true)
+    {
+        Polyhedron convex_polyhedron;
+        CGAL::convex_hull_3(vertices.begin(), vertices.end(), convex_polyhedron);
+
+        // now check if we successfully build the convex hull
+        if (convex_polyhedron.is_closed()) {
+
+            // if triangulation is true, triangulate the surfaces first (lod2.2)
+            if (triangulate) {
+                CGAL::Polygon_mesh_processing::triangulate_faces(convex_polyhedron);
+            }
+
+            // get nef polyhedron of the convex hull
+            Nef_polyhedron convex_nef_polyhedron(convex_polyhedron);
+            Nefs.emplace_back();
+            Nefs.back() = convex_nef_polyhedron;
+            std::cout<< "the convex hull is closed, build convex nef polyhedron" << '\n';
+            return true;
+        }
+        else {
+            std::cerr << "convex hull is not closed, no nef polyhedron built\n";
+            std::cerr << "building id: " << id << '\n';
+            return false;
+        }
+    }
+
+
+    /*
+    * triangulate a face with inner rings (holes)
+    * (1) project the face to 2D by dropping the dominant axis of its normal (Newell's method on the outer ring)
+    * (2) insert all rings as constraints into a constrained Delaunay triangulation
+    * (3) mark the triangles inside the domain (odd nesting level: inside the outer ring, outside the holes)
+    * (4) add the triangles of the domain to faces, oriented as the outer ring
+    * 
+    * no new vertices are created, if the rings intersect each other (the triangulation needs extra vertices)
+    * the function fails and faces is not changed
+    * 
+    * @param:
+    * vertices: vertices of the building
+    * face    : the face with inner rings, the first ring is the outer ring
+    * faces   : the triangles will be added to faces
+    * @return:
+    * true if the face is triangulated, otherwise false
+    */
+    static bool triangulate_face_with_holes(
+        const std::vector<Point_3>& vertices,
+        const Face& face,
+        std::vector<std::vector<unsigned long>>& faces)
+    {
+        const auto& outer = face.rings.front().indices;
+        if (outer.size() < 3)return false;
+
+        // (1) normal of the outer ring - Newell's method
+        double nx = 0, ny = 0, nz = 0;
+        for (std::size_t i = 0; i != outer.size(); ++i) {
+            const Point_3& p = vertices[outer[i]];
+            const Point_3& q = vertices[outer[(i + 1) % outer.size()]];
+            double px = CGAL::to_double(p.x()), py = CGAL::to_double(p.y()), pz = CGAL::to_double(p.z());
+            double qx = CGAL::to_double(q.x()), qy = CGAL::to_double(q.y()), qz = CGAL::to_double(q.z());
+            nx += (py - qy) * (pz + qz);
+            ny += (pz - qz) * (px + qx);
+            nz += (px - qx) * (py + qy);
+        }
+        int drop_axis = 2; // drop the axis with the largest normal component
+        if (std::abs(nx) >= std::abs(ny) && std::abs(nx) >= std::abs(nz))drop_axis = 0;
+        else if (std::abs(ny) >= std::abs(nz))drop_axis = 1;
+
+        auto project = [&vertices, drop_axis](unsigned long index) {
+            const Point_3& p = vertices[index];
+            double x = CGAL::to_double(p.x()), y = CGAL::to_double(p.y()), z = CGAL::to_double(p.z());
+            if (drop_axis == 0)return Inexact_kernel::Point_2(y, z);
+            if (drop_axis == 1)return Inexact_kernel::Point_2(z, x);
+            return Inexact_kernel::Point_2(x, y);
+        };
+
+        // (2) insert the rings as constraints
+        Hole_CDT cdt;
+        std::set<unsigned long> ring_vertices;
+        for (const auto& ring : face.rings) {
+            if (ring.indices.size() < 3)continue;
+            std::vector<Hole_CDT::Vertex_handle> handles;
+            handles.reserve(ring.indices.size());
+            for (auto index : ring.indices) {
+                Hole_CDT::Vertex_handle vh = cdt.insert(project(index));
+                vh->info() = (long)index;
+                handles.push_back(vh);
+                ring_vertices.insert(index);
+            }
+            for (std::size_t i = 0; i != handles.size(); ++i) {
+                Hole_CDT::Vertex_handle a = handles[i];
+                Hole_CDT::Vertex_handle b = handles[(i + 1) % handles.size()];
+                if (a != b)cdt.insert_constraint(a, b);
+            }
+        }
+
+        // intersecting rings introduce new vertices, which do not exist in the building
+        if (cdt.number_of_vertices() != ring_vertices.size())return false;
+
+        // (3) mark the domains - nesting level via flood fill, crossing a constraint increments the level
+        for (auto f = cdt.all_faces_begin(); f != cdt.all_faces_end(); ++f)f->info().nesting_level = -1;
+        std::list<Hole_CDT::Edge> border;
+        mark_domain(cdt, cdt.infinite_face(), 0, border);
+        while (!border.empty()) {
+            Hole_CDT::Edge e = border.front();
+            border.pop_front();
+            Hole_CDT::Face_handle n = e.first->neighbor(e.second);
+            if (n->info().nesting_level == -1) {
+                mark_domain(cdt, n, e.first->info().nesting_level + 1, border);
+            }
+        }
+
+        // (4) collect the triangles, orient them as the outer ring
+        std::vector<std::vector<unsigned long>> triangles;
+        for (auto f = cdt.finite_faces_begin(); f != cdt.finite_faces_end(); ++f) {
+            if (!f->info().in_domain())continue;
+            unsigned long a = (unsigned long)f->vertex(0)->info();
+            unsigned long b = (unsigned long)f->vertex(1)->info();
+            unsigned long c = (unsigned long)f->vertex(2)->info();
+
+            const Point_3& pa = vertices[a];
+            const Point_3& pb = vertices[b];
+            const Point_3& pc = vertices[c];
+            double ux = CGAL::to_double(pb.x()) - CGAL::to_double(pa.x());
+            double uy = CGAL::to_double(pb.y()) - CGAL::to_double(pa.y());
+            double uz = CGAL::to_double(pb.z()) - CGAL::to_double(pa.z());
+            double vx = CGAL::to_double(pc.x()) - CGAL::to_double(pa.x());
+            double vy = CGAL::to_double(pc.y()) - CGAL::to_double(pa.y());
+            double vz = CGAL::to_double(pc.z()) - CGAL::to_double(pa.z());
+            double dot = (uy * vz - uz * vy) * nx + (uz * vx - ux * vz) * ny + (ux * vy - uy * vx) * nz;
+
+            if (dot < 0)triangles.push_back({ a, c, b });
+            else triangles.push_back({ a, b, c });
+        }
+        if (triangles.empty())return false;
+
+        for (auto& triangle : triangles)faces.emplace_back(std::move(triangle));
+        return true;
+    }
+
+
+    /*
+    * helper of triangulate_face_with_holes()
+    * flood fill from start, all faces reachable without crossing a constraint get the same nesting level
+    * the constrained edges on the border are collected for the next level
+    */
+    static void mark_domain(Hole_CDT& cdt, Hole_CDT::Face_handle start, int level, std::list<Hole_CDT::Edge>& border)
+    {
+        if (start->info().nesting_level != -1)return;
+        std::list<Hole_CDT::Face_handle> queue;
+        queue.push_back(start);
+        while (!queue.empty()) {
+            Hole_CDT::Face_handle fh = queue.front();
+            queue.pop_front();
+            if (fh->info().nesting_level == -1) {
+                fh->info().nesting_level = level;
+                for (int i = 0; i < 3; i++) {
+                    Hole_CDT::Edge e(fh, i);
+                    Hole_CDT::Face_handle n = fh->neighbor(i);
+                    if (n->info().nesting_level == -1) {
+                        if (cdt.is_constrained(e))border.push_back(e);
+                        else queue.push_back(n);
                     }
+                }
+            }
+        }
+    }
+
 
-                    // get nef polyhedron of the convex hull
-                    Nef_polyhedron convex_nef_polyhedron(convex_polyhedron);
-                    Nefs.emplace_back();
-                    Nefs.back() = convex_nef_polyhedron;
-                    std::cout<< "the convex hull is closed, build convex nef polyhedron" << '\n';
+    /*
+    * snap rounding of the vertices in the polyhedron_builder
+    * (1) round each coordinate to the grid
+    * (2) merge the vertices which collapse to the same grid point
+    * (3) remove repeated indices in each face and drop the degenerate faces (less than 3 vertices or collinear)
+    * (4) remove the vertices which are no longer used by any face
+    * 
+    * since all buildings are shifted with the same datum, adjacent buildings are snapped to the same grid
+    * 
+    * @param:
+    * polyhedron_builder: contains the vertices and faces, will be modified
+    * grid              : grid size, e.g. 0.001 (1 mm)
+    */
+    static void snap_to_grid(Polyhedron_builder<Polyhedron::HalfedgeDS>& polyhedron_builder, double grid)
+    {
+        // (1) + (2) snap and merge, key: grid coordinates
+        std::map<std::tuple<long long, long long, long long>, unsigned long> grid_points;
+        std::vector<Point_3> snapped_vertices;
+        std::vector<unsigned long> new_index(polyhedron_builder.vertices.size());
+        for (std::size_t i = 0; i != polyhedron_builder.vertices.size(); ++i) {
+            const Point_3& v = polyhedron_builder.vertices[i];
+            long long gx = std::llround(CGAL::to_double(v.x()) / grid);
+            long long gy = std::llround(CGAL::to_double(v.y()) / grid);
+            long long gz = std::llround(CGAL::to_double(v.z()) / grid);
+
+            auto inserted = grid_points.emplace(std::make_tuple(gx, gy, gz), (unsigned long)snapped_vertices.size());
+            if (inserted.second) {
+                snapped_vertices.emplace_back(gx * grid, gy * grid, gz * grid);
+            }
+            new_index[i] = inserted.first->second;
+        }
+
+        // (3) remap the faces
+        std::vector<std::vector<unsigned long>> snapped_faces;
+        snapped_faces.reserve(polyhedron_builder.faces.size());
+        for (const auto& face : polyhedron_builder.faces) {
+            std::vector<unsigned long> snapped_face;
+            snapped_face.reserve(face.size());
+            for (auto index : face) {
+                unsigned long snapped_index = new_index[index];
+                if (snapped_face.empty() || snapped_face.back() != snapped_index) {
+                    snapped_face.push_back(snapped_index);
                 }
-                else {
-                    std::cerr << "convex hull is not closed, no nef polyhedron built\n";
+            }
+            while (snapped_face.size() > 1 && snapped_face.front() == snapped_face.back()) {
+                snapped_face.pop_back();
+            }
+            if (snapped_face.size() < 3)continue; // collapsed to an edge or a point
+
+            // collinear face -> no area
+            const Point_3& p0 = snapped_vertices[snapped_face[0]];
+            const Point_3& p1 = snapped_vertices[snapped_face[1]];
+            bool degenerate = true;
+            for (std::size_t k = 2; k != snapped_face.size(); ++k) {
+                if (!CGAL::collinear(p0, p1, snapped_vertices[snapped_face[k]])) {
+                    degenerate = false;
+                    break;
                 }
             }
+            if (degenerate)continue;
 
-            /* test to write the polyhedron to .off file --------------------------------------------------------*/
+            snapped_faces.emplace_back(std::move(snapped_face));
+        }
 
-            // Write polyhedron in Object File Format (OFF).
-            // CGAL::set_ascii_mode(std::cout);
-            // std::cout << "OFF" << std::endl << polyhedron.size_of_vertices() << ' '
-            //     << polyhedron.size_of_facets() << " 0" << std::endl;
-            // std::copy(polyhedron.points_begin(), polyhedron.points_end(),
-            //     std::ostream_iterator<Point_3>( std::cout, "\n"));
-            // for (Facet_iterator i = polyhedron.facets_begin(); i != polyhedron.facets_end(); ++i) 
-            // {
-            //     Halfedge_facet_circulator j = i->facet_begin();
-            //     // Facets in polyhedral surfaces are at least triangles.
-            //     std::cout << CGAL::circulator_size(j) << ' ';
-            //     do {
-            //         std::cout << ' ' << std::distance(polyhedron.vertices_begin(), j->vertex());
-            //     } while ( ++j != i->facet_begin());
-            //     std::cout << std::endl;
-            // }
+        // (4) remove the unused vertices, Polyhedron_builder doesn't like unconnected vertices
+        std::vector<long long> used_index(snapped_vertices.size(), -1);
+        polyhedron_builder.vertices.clear();
+        for (auto& face : snapped_faces) {
+            for (auto& index : face) {
+                if (used_index[index] < 0) {
+                    used_index[index] = (long long)polyhedron_builder.vertices.size();
+                    polyhedron_builder.vertices.push_back(snapped_vertices[index]);
+                }
+                index = (unsigned long)used_index[index];
+            }
+        }
 
-            // std::cout<<polyhedron<<std::endl;
+        std::size_t dropped = polyhedron_builder.faces.size() - snapped_faces.size();
+        if (dropped > 0) {
+            std::cout << "snap rounding: " << dropped << " degenerate faces dropped\n";
+        }
+        polyhedron_builder.faces = std::move(snapped_faces);
+    }
 
 
+    /*
+    * the repair path for the buildings flagged by the pre-screen
+    * (1) repair the polygon soup: merge duplicate points, remove degenerate and duplicate polygons
+    * (2) orient the polygon soup consistently
+    * (3) convert the polygon soup to the polyhedron
+    * return false if the soup can not be oriented without duplicating vertices (the polyhedron is left empty),
+    * polygon_soup_to_polygon_mesh() requires an oriented soup and only checks it in debug builds
+    * the polyhedron should be checked (is_closed()) afterwards
+    */
+    static bool repair_polyhedron(
+        const Polyhedron_builder<Polyhedron::HalfedgeDS>& polyhedron_builder,
+        Polyhedron& polyhedron)
+    {
+        std::vector<Point_3> points = polyhedron_builder.vertices;
+        std::vector<std::vector<std::size_t>> polygons;
+        polygons.reserve(polyhedron_builder.faces.size());
+        for (const auto& face : polyhedron_builder.faces) {
+            polygons.emplace_back(face.begin(), face.end());
         }
 
+        PMP::repair_polygon_soup(points, polygons);
+        if (!PMP::orient_polygon_soup(points, polygons) || !PMP::is_polygon_soup_a_polygon_mesh(polygons))return false;
+        PMP::polygon_soup_to_polygon_mesh(points, polygons, polyhedron);
+        return true;
     }
 
 
@@ -273,6 +678,8 @@ struct Shell_explorer {
     std::vector<Point_3> cleaned_vertices; // after extracting geometries, process the vertices and store cleaned vertices for one shell
     std::vector<std::vector<unsigned long>> cleaned_faces; // after extracting geometries, process the face indices and store cleaned faces for one shell
 
+    std::size_t volume = 0; // index of the volume this shell belongs to, 0 - the outer volume
+
     void visit(Nef_polyhedron::Vertex_const_handle v) {}
     void visit(Nef_polyhedron::Halfedge_const_handle he) {}
     void visit(Nef_polyhedron::SHalfedge_const_handle she) {}
@@ -309,6 +716,16 @@ struct Shell_explorer {
 
 
 
+/*
+* engines for 3D Minkowski sum with the cube
+* CGAL         : CGAL::minkowski_sum_3
+* DECOMPOSITION: decompose the nef into convex pieces, sum each piece in closed form
+*                (convex hull of the piece's vertices offset by the cube's corners), then balanced union
+*/
+enum class Minkowski_engine { CGAL, DECOMPOSITION };
+
+
+
 /*
 * class to process Nef
 * (1)extract geometries of a nef polyhedron
@@ -318,6 +735,13 @@ struct Shell_explorer {
 class NefProcessing
 {
 public:
+    // which engine is used in minkowski_sum()
+    inline static Minkowski_engine engine = Minkowski_engine::CGAL;
+
+    // deterministic output: canonical vertex / face / shell order in process_shells_for_cityjson() and FileIO::write_OFF()
+    inline static bool deterministic = false;
+
+
     /*
     * Extract geometries from a Nef polyhedron
     * @params:
@@ -338,12 +762,14 @@ public:
             CGAL_forall_shells_of(current_shell, current_volume)
             {
                 Shell_explorer se;
+                se.volume = (std::size_t)volume_count;
                 Nef_polyhedron::SFace_const_handle sface_in_shell(current_shell);
                 nef.visit_shell_objects(sface_in_shell, se);
 
                 // add the se to shell_explorers
                 shell_explorers.emplace_back(se);
             }
+            ++volume_count;
         }
 
         // prompt some info
@@ -426,6 +852,25 @@ public:
             }
         }
         // now we have cleaned_vertices and cleaned_faces to write to cityjson ------------------------------
+
+
+        // step 3 (deterministic output only)
+        // canonical order of the vertices and faces of each shell, and of the shells ----------------------
+        // the shells of the outer volume stay in front (shell_explorers[0] is the exterior),
+        // the other shells are ordered by their smallest vertex
+        if (deterministic) {
+            for (auto& se : shell_explorers) {
+                canonicalize(se.cleaned_vertices, se.cleaned_faces);
+            }
+            std::stable_sort(shell_explorers.begin(), shell_explorers.end(), [](const Shell_explorer& a, const Shell_explorer& b) {
+                if ((a.volume == 0) != (b.volume == 0))return a.volume == 0;
+                if (a.cleaned_vertices.empty() || b.cleaned_vertices.empty())return a.cleaned_vertices.size() < b.cleaned_vertices.size();
+                if (a.cleaned_vertices.front() != b.cleaned_vertices.front())
+                    return CGAL::lexicographically_xyz_smaller(a.cleaned_vertices.front(), b.cleaned_vertices.front());
+                if (a.cleaned_vertices.size() != b.cleaned_vertices.size())return a.cleaned_vertices.size() < b.cleaned_vertices.size();
+                return a.cleaned_faces < b.cleaned_faces;
+            });
+        }
         
         std::cout << "done" << '\n';
 
@@ -433,6 +878,41 @@ public:
 
 
 
+    /*
+    * canonical order of a polygon soup, independent of how it was traversed
+    * the vertices are sorted lexicographically (x, y, z, exact comparison), the face indices are remapped,
+    * each face is rotated to start at its smallest index (the orientation is kept) and the faces are sorted
+    *
+    * @param:
+    * vertices: unique vertices, will be reordered
+    * faces   : indices into vertices, will be remapped and reordered
+    */
+    static void canonicalize(std::vector<Point_3>& vertices, std::vector<std::vector<unsigned long>>& faces)
+    {
+        std::vector<unsigned long> order(vertices.size());
+        for (unsigned long i = 0; i != order.size(); ++i)order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&vertices](unsigned long a, unsigned long b) {
+            return CGAL::lexicographically_xyz_smaller(vertices[a], vertices[b]);
+        });
+
+        std::vector<Point_3> sorted_vertices;
+        std::vector<unsigned long> new_index(vertices.size());
+        sorted_vertices.reserve(vertices.size());
+        for (unsigned long i = 0; i != order.size(); ++i) {
+            sorted_vertices.push_back(vertices[order[i]]);
+            new_index[order[i]] = i;
+        }
+        vertices.swap(sorted_vertices);
+
+        for (auto& face : faces) {
+            for (auto& index : face)index = new_index[index];
+            if (!face.empty())std::rotate(face.begin(), std::min_element(face.begin(), face.end()), face.end());
+        }
+        std::sort(faces.begin(), faces.end());
+    }
+
+
+
     /*
     * make a cube (type: Polyhedron) with side length: size
     * @param: 
@@ -533,23 +1013,327 @@ public:
 
 
 
+    /*
+    * get the cube (the structuring element of minkowski sum) with side length: size
+    * the cube is built only once for each size and then reused for all buildings
+    * 
+    * the cache is per thread (thread_local): CGAL objects are reference counted and
+    * the lazy exact numbers are updated when evaluated, thus sharing one cube across threads is not safe
+    * 
+    * only the construction of the cube is cached, its convex decomposition is not reused:
+    * minkowski_sum_3 has no interface for passing decomposed operands, it decomposes both of them on every call
+    * (the cube is convex, its decomposition finds no reflex edge and is cheap, the one of the building dominates)
+    */
+    static Nef_polyhedron& get_cube(double size = 0.1)
+    {
+        thread_local std::map<double, Nef_polyhedron> cubes; // size -> cube
+        auto found = cubes.find(size);
+        if (found == cubes.end()) {
+            found = cubes.emplace(size, make_cube(size)).first;
+        }
+        return found->second;
+    }
+
+
+
+    /*
+    * deep copy of a nef polyhedron
+    * a copy-constructed nef shares its representation with the original,
+    * a nef which is changed in place (e.g. by minkowski_sum()) and used afterwards needs a deep copy
+    */
+    static Nef_polyhedron copy_nef(const Nef_polyhedron& nef)
+    {
+        std::stringstream ss;
+        ss << nef;
+        Nef_polyhedron copy;
+        ss >> copy;
+        return copy;
+    }
+
+
+
     /*
     * 3D Minkowski sum
     * details: https://doc.cgal.org/latest/Minkowski_sum_3/index.html#Chapter_3D_Minkowski_Sum_of_Polyhedra
     * 
+    * minkowski_sum_3 decomposes nef in place (cgal engine): afterwards it has extra facets inside the solid,
+    * its point set and its vertices on the boundary are not changed (e.g. its convex hull is the same),
+    * use copy_nef() if the nef is expanded again or its facets are used afterwards
+    * 
     * @param
     * nef : the nef polyhedron which needs to be merged
     * size: a cube's side length
     */
     static Nef_polyhedron minkowski_sum(Nef_polyhedron& nef, double size = 0.1)
     {
-        Nef_polyhedron cube = make_cube(size);
-        return CGAL::minkowski_sum_3(nef, cube);     
+        if (engine == Minkowski_engine::DECOMPOSITION) {
+            return minkowski_sum_decomposition(nef, size);
+        }
+        return CGAL::minkowski_sum_3(nef, get_cube(size));
+    }
+
+
+
+    /*
+    * 3D Minkowski sum with the cube via convex decomposition
+    * minkowski_sum_3 decomposes both operands, sums each pair of pieces and unions the results
+    * since the cube is convex and axis-aligned, the sum of a convex piece and the cube is simply
+    * the convex hull of the piece's vertices offset by the 8 corners of the cube
+    * 
+    * (1) decompose a copy of the nef into convex pieces (convex_decomposition_3)
+    * (2) for each piece (bounded marked volume), build the convex hull of the offset vertices
+    * (3) union the pieces with a balanced union
+    * 
+    * @param
+    * nef : the nef polyhedron which needs to be merged
+    * size: a cube's side length
+    */
+    static Nef_polyhedron minkowski_sum_decomposition(const Nef_polyhedron& nef, double size = 0.1)
+    {
+        // (1) decomposition, it only inserts facets (the point set of the nef is not changed)
+        // on a deep copy, a copied nef would share the representation of the caller's nef
+        Nef_polyhedron decomposed = copy_nef(nef);
+        CGAL::convex_decomposition_3(decomposed);
+
+        // corners of the cube, the same cube as make_cube(): [0, size]^3
+        std::vector<Kernel::Vector_3> corners;
+        corners.reserve(8);
+        for (int i = 0; i != 8; ++i) {
+            corners.emplace_back((i & 1) ? size : 0, (i & 2) ? size : 0, (i & 4) ? size : 0);
+        }
+
+        // (2) closed-form sum for each convex piece, the first volume is the outer volume
+        std::vector<Nef_polyhedron> pieces;
+        Nef_polyhedron::Volume_const_iterator ci = ++decomposed.volumes_begin();
+        for (; ci != decomposed.volumes_end(); ++ci) {
+            if (!ci->mark())continue;
+
+            Polyhedron piece;
+            decomposed.convert_inner_shell_to_polyhedron(ci->shells_begin(), piece);
+
+            std::vector<Point_3> offset_points;
+            offset_points.reserve(piece.size_of_vertices() * corners.size());
+            for (auto p = piece.points_begin(); p != piece.points_end(); ++p) {
+                for (const auto& corner : corners)offset_points.push_back(*p + corner);
+            }
+
+            Polyhedron hull;
+            CGAL::convex_hull_3(offset_points.begin(), offset_points.end(), hull);
+            if (!hull.is_closed())continue;
+            pieces.emplace_back(hull);
+        }
+
+        // no convex piece (e.g. empty or degenerate nef), use minkowski_sum_3 instead
+        if (pieces.empty()) {
+            Nef_polyhedron nef_copy(nef);
+            return CGAL::minkowski_sum_3(nef_copy, get_cube(size));
+        }
+
+        // (3) union
+        return balanced_union(pieces);
+    }
+
+
+
+    /*
+    * union all the nefs with a balanced (pairwise) order:
+    * merge pairs, then pairs of pairs, and so on
+    * compared to the sequential union (big_nef += nef) the operands are smaller in each union
+    * 
+    * @param
+    * nefs: the nefs to be merged, will be changed (used as the working space)
+    * @return
+    * the union of all nefs
+    */
+    static Nef_polyhedron balanced_union(std::vector<Nef_polyhedron>& nefs)
+    {
+        if (nefs.empty())return Nef_polyhedron();
+
+        for (std::size_t step = 1; step < nefs.size(); step *= 2) {
+            for (std::size_t i = 0; i + step < nefs.size(); i += 2 * step) {
+                nefs[i] += nefs[i + step];
+            }
+        }
+        return nefs[0];
+    }
+
+
+
+    /*
+    * convex hull of a nef polyhedron, built from all its vertices
+    * used as the fallback if minkowski sum of the nef fails
+    * 
+    * @param
+    * nef        : the nef polyhedron
+    * convex_nef : the convex hull as a nef polyhedron
+    * @return
+    * true if the convex hull is closed (convex_nef is set), otherwise false
+    */
+    static bool get_convex_nef(const Nef_polyhedron& nef, Nef_polyhedron& convex_nef)
+    {
+        std::vector<Point_3> points;
+        points.reserve(nef.number_of_vertices());
+        Nef_polyhedron::Vertex_const_iterator v;
+        for (v = nef.vertices_begin(); v != nef.vertices_end(); ++v) {
+            points.push_back(v->point());
+        }
+
+        Polyhedron convex_polyhedron;
+        CGAL::convex_hull_3(points.begin(), points.end(), convex_polyhedron);
+        if (!convex_polyhedron.is_closed())return false;
+
+        convex_nef = Nef_polyhedron(convex_polyhedron);
+        return true;
+    }
+
+
+
+    /*
+    * move the isolated nefs out of nefs
+    * a nef is isolated if its bounding box is farther than the distance from the bounding boxes of all other nefs,
+    * thus it can not touch any other nef after expansion and does not need minkowski sum
+    *
+    * @param
+    * nefs         : all nefs of a block, only the nefs which need expansion are kept
+    * isolated_nefs: the isolated nefs will be added to this vector (unchanged)
+    * distance     : the minkowski param
+    * @return
+    * number of isolated nefs
+    */
+    static std::size_t separate_isolated(
+        std::vector<Nef_polyhedron>& nefs,
+        std::vector<Nef_polyhedron>& isolated_nefs,
+        double distance = 0.1)
+    {
+        // bounding boxes: xmin, ymin, zmin, xmax, ymax, zmax
+        std::vector<std::vector<double>> bboxes;
+        bboxes.reserve(nefs.size());
+        for (const auto& nef : nefs) {
+            std::vector<double> bbox = { 1e12, 1e12, 1e12, -1e12, -1e12, -1e12 };
+            Nef_polyhedron::Vertex_const_iterator v;
+            for (v = nef.vertices_begin(); v != nef.vertices_end(); ++v) {
+                double c[3] = { CGAL::to_double(v->point().x()), CGAL::to_double(v->point().y()), CGAL::to_double(v->point().z()) };
+                for (int i = 0; i != 3; ++i) {
+                    bbox[i] = std::min(bbox[i], c[i]);
+                    bbox[i + 3] = std::max(bbox[i + 3], c[i]);
+                }
+            }
+            bboxes.emplace_back(bbox);
+        }
+
+        // a nef expanded by the cube grows at most by the distance, the gap between two boxes must be larger than that
+        std::vector<bool> isolated(nefs.size(), true);
+        for (std::size_t a = 0; a != nefs.size(); ++a)
+            for (std::size_t b = a + 1; b < nefs.size(); ++b) {
+                bool apart = false;
+                for (int i = 0; i != 3; ++i) {
+                    if (bboxes[a][i] - bboxes[b][i + 3] > distance || bboxes[b][i] - bboxes[a][i + 3] > distance)apart = true;
+                }
+                if (!apart)isolated[a] = isolated[b] = false;
+            }
+
+        std::vector<Nef_polyhedron> kept;
+        kept.reserve(nefs.size());
+        std::size_t count = 0;
+        for (std::size_t a = 0; a != nefs.size(); ++a) {
+            if (isolated[a]) {
+                isolated_nefs.emplace_back(std::move(nefs[a]));
+                ++count;
+            }
+            else kept.emplace_back(std::move(nefs[a]));
+        }
+        nefs.swap(kept);
+
+        return count;
+    }
+
+
+
+    /*
+    * reorder the nefs along a kd-tree of their centroids, as the union plan of balanced_union()
+    * 
+    * the cost of a union grows with the operands, merging two far-apart nefs early creates an intermediate
+    * with two disjoint volumes which every later union has to traverse
+    * thus the nefs are split recursively at the longest extent of their centroids,
+    * the split position is the largest power of two below the count: the same split as balanced_union() (and MT::union_nefs_async())
+    * each subtree of the union then merges the nefs of one kd-tree cell, nearby (touching) nefs are merged first
+    * 
+    * the order only depends on the centroids, thus it is deterministic
+    * 
+    * @param
+    * nefs: the nefs to be merged, will be reordered
+    */
+    static void spatial_order(std::vector<Nef_polyhedron>& nefs)
+    {
+        if (nefs.size() < 3)return; // the union plan is the same for any order
+
+        // centroids of the vertices
+        std::vector<std::array<double, 3>> centroids;
+        centroids.reserve(nefs.size());
+        for (const auto& nef : nefs) {
+            std::array<double, 3> centroid = { 0, 0, 0 };
+            Nef_polyhedron::Vertex_const_iterator v;
+            for (v = nef.vertices_begin(); v != nef.vertices_end(); ++v) {
+                centroid[0] += CGAL::to_double(v->point().x());
+                centroid[1] += CGAL::to_double(v->point().y());
+                centroid[2] += CGAL::to_double(v->point().z());
+            }
+            std::size_t count = nef.number_of_vertices();
+            if (count != 0)for (auto& c : centroid)c /= (double)count;
+            centroids.emplace_back(centroid);
+        }
+
+        std::vector<std::size_t> order(nefs.size());
+        for (std::size_t i = 0; i != order.size(); ++i)order[i] = i;
+        kd_order(centroids, order.begin(), order.end());
+
+        std::vector<Nef_polyhedron> ordered;
+        ordered.reserve(nefs.size());
+        for (auto i : order)ordered.emplace_back(std::move(nefs[i]));
+        nefs.swap(ordered);
     }
 
 
 
 protected:
+    /*
+    * recursive step of spatial_order()
+    * split [first, last) at the largest power of two below the count, along the longest extent of the centroids
+    */
+    static void kd_order(
+        const std::vector<std::array<double, 3>>& centroids,
+        std::vector<std::size_t>::iterator first,
+        std::vector<std::size_t>::iterator last)
+    {
+        std::size_t count = (std::size_t)(last - first);
+        if (count < 3)return;
+
+        // longest extent
+        std::array<double, 3> lower = centroids[*first], upper = centroids[*first];
+        for (auto it = first; it != last; ++it)
+            for (int i = 0; i != 3; ++i) {
+                lower[i] = std::min(lower[i], centroids[*it][i]);
+                upper[i] = std::max(upper[i], centroids[*it][i]);
+            }
+        int axis = 0;
+        for (int i = 1; i != 3; ++i) {
+            if (upper[i] - lower[i] > upper[axis] - lower[axis])axis = i;
+        }
+
+        // the first half of the union tree takes the largest power of two below the count
+        std::size_t half = 1;
+        while (half * 2 < count)half *= 2;
+
+        auto middle = first + half;
+        std::nth_element(first, middle, last, [&centroids, axis](std::size_t a, std::size_t b) {
+            if (centroids[a][axis] != centroids[b][axis])return centroids[a][axis] < centroids[b][axis];
+            return a < b; // ties by the input position
+        });
+        kd_order(centroids, first, middle);
+        kd_order(centroids, middle, last);
+    }
+
+
     /*
     * The vertex_exist_check() and find_vertex_index() fucntions are also in JsonHandler class
     * there may be other ways to avoid code repeatness
@@ -745,7 +1529,10 @@ public:
     static void remeshing(Nef_polyhedron& big_nef, const std::string& file, double target_edge_length) {
         Polyhedron polyhedron;
 
-        if (!big_nef.is_simple()) {
+        // is_simple() is the precondition of the conversion, always checked, only recorded according to the validation level
+        bool simple = big_nef.is_simple();
+        if (Validation::should_check())Validation::record("big nef is_simple", file, simple);
+        if (!simple) {
             std::cerr << "big nef is not simple, can not convert to polyhedron, please check" << '\n';
             return;
         }
@@ -756,7 +1543,9 @@ public:
         // convert to surface mesh
         Mesh mesh;
         CGAL::copy_face_graph(polyhedron, mesh);
-        std::cout << "is polygon mesh valid? " << mesh.is_valid() << '\n';
+        if (Validation::should_check()) {
+            Validation::record("mesh is_valid", file, mesh.is_valid());
+        }
 
         // remeshing
         unsigned int nb_iter = 3;
@@ -0,0 +1,150 @@
+#pragma once
+
+// JsonHandler - for Point_3 (exact kernel)
+#include "JsonHandler.hpp"
+
+// inexact constructions kernel - for screening only, no exact objects are created
+#include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
+#include <CGAL/Surface_mesh.h>
+#include <CGAL/boost/graph/helpers.h> // for CGAL::is_closed()
+#include <CGAL/Polygon_mesh_processing/orient_polygon_soup.h>
+#include <CGAL/Polygon_mesh_processing/polygon_soup_to_polygon_mesh.h>
+#include <CGAL/Polygon_mesh_processing/triangulate_faces.h>
+#include <CGAL/Polygon_mesh_processing/self_intersections.h>
+#include <CGAL/Polygon_mesh_processing/shape_predicates.h>
+
+
+// typedefs
+typedef CGAL::Exact_predicates_inexact_constructions_kernel Inexact_kernel;
+typedef CGAL::Surface_mesh<Inexact_kernel::Point_3>         Inexact_mesh;
+
+
+
+/*
+* which path a building takes when building its nef polyhedron
+* DIRECT  : the building is fine, use Polyhedron_builder directly
+* REPAIR  : the polygon soup needs to be repaired / oriented before building
+* FALLBACK: the building is broken (not orientable, open shell or self-intersecting), use its convex hull
+*/
+enum class Route { DIRECT, REPAIR, FALLBACK };
+
+
+
+/*
+* result of the pre-screen of one building
+*/
+struct Prescreen_result
+{
+	Route route = Route::DIRECT;
+	bool polygon_mesh = true; // false if the soup is non-manifold or not consistently oriented
+	bool closed = true; // false if the shell is open
+	bool self_intersecting = false; // true if the shell has self-intersections
+	std::size_t degenerate_faces = 0; // number of degenerate (triangulated) faces
+};
+
+
+
+/*
+* class to screen a building before any exact object is created
+* all the checks are performed on a Surface_mesh with inexact constructions (EPICK)
+* which is much cheaper than building Polyhedron_3 / Nef_polyhedron_3 with the exact kernel
+* only to find out that the building is broken
+*
+* the checks are:
+* (1) whether the polygon soup can be converted to a polygon mesh (manifold, consistently oriented)
+* (2) closedness
+* (3) degenerate faces
+* (4) self-intersections
+*/
+class Prescreen
+{
+public:
+
+	/*
+	* screen one building
+	*
+	* @param:
+	* vertices : vertices of the building (exact kernel, converted to double for screening)
+	* faces    : faces of the building, indices in vertices
+	* @return:
+	* the screen result, including the route of the building
+	*/
+	static Prescreen_result screen(
+		const std::vector<Point_3>& vertices,
+		const std::vector<std::vector<unsigned long>>& faces)
+	{
+		namespace PMP = CGAL::Polygon_mesh_processing;
+
+		Prescreen_result result;
+
+		// convert to inexact polygon soup
+		std::vector<Inexact_kernel::Point_3> points;
+		points.reserve(vertices.size());
+		for (const auto& v : vertices) {
+			points.emplace_back(CGAL::to_double(v.x()), CGAL::to_double(v.y()), CGAL::to_double(v.z()));
+		}
+
+		std::vector<std::vector<std::size_t>> polygons;
+		polygons.reserve(faces.size());
+		for (const auto& face : faces) {
+			polygons.emplace_back(face.begin(), face.end());
+		}
+
+		// (1) non-manifold or inconsistently oriented soup -> Polyhedron_builder will fail, needs repair
+		// the soup must be orientable without duplicating vertices, otherwise the repair path can not build it either
+		// (polygon_soup_to_polygon_mesh() only checks its precondition in debug builds)
+		if (!PMP::is_polygon_soup_a_polygon_mesh(polygons)) {
+			result.polygon_mesh = false;
+			if (!PMP::orient_polygon_soup(points, polygons) || !PMP::is_polygon_soup_a_polygon_mesh(polygons)) {
+				result.route = Route::FALLBACK;
+				return result;
+			}
+		}
+
+		Inexact_mesh mesh;
+		PMP::polygon_soup_to_polygon_mesh(points, polygons, mesh);
+
+		// (2) open shell -> neither the direct nor the repair path can build a closed polyhedron
+		if (!CGAL::is_closed(mesh)) {
+			result.closed = false;
+			result.route = Route::FALLBACK;
+			return result;
+		}
+
+		// triangulate for the degeneracy and self-intersection checks (the nef is built from triangulated surfaces as well)
+		PMP::triangulate_faces(mesh);
+
+		// (3) degenerate faces -> the repair path removes them
+		// check them before self-intersections since degenerate triangles would be reported as intersections
+		for (auto f : mesh.faces()) {
+			if (PMP::is_degenerate_triangle_face(f, mesh))++result.degenerate_faces;
+		}
+
+		if (!result.polygon_mesh || result.degenerate_faces > 0) {
+			result.route = Route::REPAIR;
+			return result;
+		}
+
+		// (4) self-intersecting shell -> the nef would be invalid and minkowski sum would fail
+		if (PMP::does_self_intersect(mesh)) {
+			result.self_intersecting = true;
+			result.route = Route::FALLBACK;
+		}
+
+		return result;
+	}
+
+
+
+	/*
+	* get the string of a route, for prompting info
+	*/
+	static std::string route_string(Route route)
+	{
+		switch (route) {
+		case Route::DIRECT: return "direct";
+		case Route::REPAIR: return "repair";
+		default: return "fallback";
+		}
+	}
+};
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <tuple>
+#include <algorithm>
+
+#include "Polyhedron.hpp"
+
+
+
+/*
+* class for closing the gaps between adjacent buildings without minkowski sum
+*
+* the gaps between party walls of a block are usually only a few millimetres wide
+* inflating every building by the cube closes them, but moves all the walls by the cube size
+* and minkowski_sum_3 is by far the most expensive step of the pipeline
+*
+* instead, the vertices of neighbouring buildings which are within the tolerance are snapped together:
+* (0) the faces are triangulated first, moving a vertex keeps every face planar
+* (1) vertex - vertex: vertices of different buildings closer than the tolerance are clustered
+*     (via a uniform grid over the whole block), each cluster is moved to the vertex of the building with the smallest index
+*     a cluster chaining further than the tolerance from that vertex, or holding two vertices of one building, is rejected
+* (2) vertex - face  : a remaining vertex closer than the tolerance to a face of a building with a smaller index
+*     is projected onto the nearest such face (found via a second uniform grid, exact projection onto the supporting plane)
+* thus the shared walls coincide exactly and the block can be unioned directly,
+* the walls of the building with the smallest index keep their original positions
+*
+* the union of the snapped nefs should be regularized to remove the shared walls from the interior
+*
+* usage:
+* Snap snap(tolerance);
+* snap.build(jhandles, build_options, nefs); // instead of Build::build_nef_polyhedron() for each building
+* // no minkowski sum, union nefs directly and call regularization() on the result
+*/
+class Snap
+{
+public:
+
+	/*
+	* @param:
+	* tolerance: vertices (and faces) closer than this distance are snapped together, e.g. the minkowski param
+	*/
+	Snap(double tolerance = 0.01) : tolerance(tolerance) {}
+
+
+
+	/*
+	* snap the buildings of one block together and build one nef for each building
+	*
+	* @param:
+	* jhandles: all buildings in one block
+	* options : see Build_options
+	* Nefs    : the built nefs will be added to Nefs
+	*/
+	void build(const std::vector<JsonHandler>& jhandles, const Build_options& options, std::vector<Nef_polyhedron>& Nefs)
+	{
+		builders.clear();
+		ids.clear();
+		clustered.clear();
+
+		for (const auto& jhandle : jhandles) {
+			builders.emplace_back();
+			if (!Build::get_polyhedron_builder(jhandle, builders.back(), options)) {
+				builders.pop_back();
+				continue;
+			}
+			ids.push_back(jhandle.solids[0].id);
+			triangulate(builders.back());
+		}
+
+		std::size_t vertex_snaps = snap_vertices();
+		std::size_t face_snaps = snap_to_faces();
+		std::cout << "snapping: " << vertex_snaps << " vertices snapped to vertices, "
+			<< face_snaps << " vertices snapped to faces\n";
+
+		for (std::size_t b = 0; b != builders.size(); ++b) {
+			Build::build_nef_polyhedron(builders[b], ids[b], Nefs, options);
+		}
+		std::cout << "there are " << Nefs.size() << " " << "nef polyhedra in total" << '\n';
+	}
+
+
+
+protected:
+
+	typedef std::tuple<long long, long long, long long> Cell;
+	typedef std::pair<std::size_t, std::size_t> Vertex_handle; // (building index, vertex index)
+
+
+
+	/*
+	* (0) triangulate the faces of a building (see Build::triangulate_face_with_holes())
+	* a face which can not be triangulated is kept
+	*/
+	static void triangulate(Polyhedron_builder<Polyhedron::HalfedgeDS>& builder)
+	{
+		std::vector<std::vector<unsigned long>> triangles;
+		triangles.reserve(builder.faces.size());
+		for (auto& face : builder.faces) {
+			if (face.size() > 3) {
+				Face polygon;
+				polygon.rings.emplace_back();
+				polygon.rings.back().indices = face;
+				if (Build::triangulate_face_with_holes(builder.vertices, polygon, triangles))continue;
+			}
+			triangles.emplace_back(std::move(face));
+		}
+		builder.faces.swap(triangles);
+	}
+
+
+
+	/*
+	* (1) vertex - vertex snapping
+	* return the number of moved vertices
+	*/
+	std::size_t snap_vertices()
+	{
+		// uniform grid, cell size = tolerance, thus the neighbours of a vertex are in the 27 surrounding cells
+		std::map<Cell, std::vector<Vertex_handle>> grid;
+		for (std::size_t b = 0; b != builders.size(); ++b) {
+			for (std::size_t v = 0; v != builders[b].vertices.size(); ++v) {
+				grid[get_cell(builders[b].vertices[v])].emplace_back(b, v);
+			}
+		}
+
+		// union-find over all vertices of the block, the root is the smallest (building, vertex) pair
+		std::map<Vertex_handle, Vertex_handle> parent;
+		auto find = [&parent](Vertex_handle h) {
+			auto it = parent.find(h);
+			while (it != parent.end() && it->second != h) {
+				h = it->second;
+				it = parent.find(h);
+			}
+			return h;
+		};
+
+		for (const auto& cell : grid) {
+			for (const auto& h : cell.second) {
+				const Point_3& p = builders[h.first].vertices[h.second];
+				for (long long dx = -1; dx <= 1; ++dx)
+					for (long long dy = -1; dy <= 1; ++dy)
+						for (long long dz = -1; dz <= 1; ++dz) {
+							Cell neighbour(std::get<0>(cell.first) + dx, std::get<1>(cell.first) + dy, std::get<2>(cell.first) + dz);
+							auto found = grid.find(neighbour);
+							if (found == grid.end())continue;
+
+							for (const auto& g : found->second) {
+								if (g.first == h.first)continue; // only snap across buildings
+								if (squared_distance(p, builders[g.first].vertices[g.second]) > tolerance * tolerance)continue;
+
+								Vertex_handle rh = find(h);
+								Vertex_handle rg = find(g);
+								if (rh == rg)continue;
+								if (rg < rh)std::swap(rh, rg);
+								parent[rh] = rh;
+								parent[rg] = rh;
+							}
+						}
+			}
+		}
+
+		// the clusters, keyed by their root
+		std::map<Vertex_handle, std::vector<Vertex_handle>> clusters;
+		for (const auto& node : parent) {
+			clusters[find(node.first)].push_back(node.first);
+		}
+
+		// move each vertex to its root
+		// the union-find chains neighbours, a cluster may span more than the tolerance or merge two vertices of one building
+		std::size_t count = 0;
+		std::size_t rejected = 0;
+		for (const auto& cluster : clusters) {
+			const Point_3& target = builders[cluster.first.first].vertices[cluster.first.second];
+			std::set<std::size_t> buildings;
+			bool valid = true;
+			for (const auto& h : cluster.second) {
+				if (!buildings.insert(h.first).second ||
+					squared_distance(target, builders[h.first].vertices[h.second]) > tolerance * tolerance) {
+					valid = false;
+					break;
+				}
+			}
+			if (!valid) {
+				++rejected;
+				continue;
+			}
+
+			for (const auto& h : cluster.second) {
+				clustered.insert(h); // the root is not moved by the vertex - face snapping either
+				if (h == cluster.first)continue;
+				builders[h.first].vertices[h.second] = target;
+				++count;
+			}
+		}
+		if (rejected != 0)std::cout << "snapping: " << rejected << " vertex clusters rejected (wider than the tolerance)\n";
+		return count;
+	}
+
+
+
+	/*
+	* (2) vertex - face snapping, for the vertices not clustered in (1)
+	* the faces are found with a uniform grid over the block, as the vertices in (1):
+	* the cell size is the median face size (at least the tolerance), each face is stored in the cells of its bounding box,
+	* thus the candidates of a vertex are the faces of its own cell
+	* the vertex is projected onto the nearest candidate (the result does not depend on the face order)
+	* return the number of moved vertices
+	*/
+	std::size_t snap_to_faces()
+	{
+		typedef std::pair<std::size_t, std::size_t> Face_handle; // (building index, face index)
+
+		// bounding boxes of the faces, expanded by twice the tolerance:
+		// the faces of a building are moved by up to the tolerance when its own vertices are snapped
+		std::vector<std::pair<Face_handle, std::vector<double>>> face_bboxes; // xmin, ymin, zmin, xmax, ymax, zmax
+		std::vector<double> extents;
+		for (std::size_t b = 0; b + 1 < builders.size(); ++b) { // the faces of the last building are never snapped to
+			for (std::size_t f = 0; f != builders[b].faces.size(); ++f) {
+				std::vector<double> bbox = { 1e30, 1e30, 1e30, -1e30, -1e30, -1e30 };
+				for (auto index : builders[b].faces[f]) {
+					const Point_3& v = builders[b].vertices[index];
+					double c[3] = { CGAL::to_double(v.x()), CGAL::to_double(v.y()), CGAL::to_double(v.z()) };
+					for (int i = 0; i != 3; ++i) {
+						bbox[i] = std::min(bbox[i], c[i] - 2 * tolerance);
+						bbox[i + 3] = std::max(bbox[i + 3], c[i] + 2 * tolerance);
+					}
+				}
+				extents.push_back(std::max({ bbox[3] - bbox[0], bbox[4] - bbox[1], bbox[5] - bbox[2] }));
+				face_bboxes.emplace_back(Face_handle(b, f), bbox);
+			}
+		}
+		if (face_bboxes.empty())return 0;
+
+		std::nth_element(extents.begin(), extents.begin() + extents.size() / 2, extents.end());
+		double cell_size = std::max(tolerance, extents[extents.size() / 2]);
+
+		std::map<Cell, std::vector<Face_handle>> grid; // the faces in each cell, in the order (building, face)
+		for (const auto& face_bbox : face_bboxes) {
+			const auto& bbox = face_bbox.second;
+			Cell low = get_cell(bbox[0], bbox[1], bbox[2], cell_size);
+			Cell high = get_cell(bbox[3], bbox[4], bbox[5], cell_size);
+			for (long long x = std::get<0>(low); x <= std::get<0>(high); ++x)
+				for (long long y = std::get<1>(low); y <= std::get<1>(high); ++y)
+					for (long long z = std::get<2>(low); z <= std::get<2>(high); ++z) {
+						grid[Cell(x, y, z)].push_back(face_bbox.first);
+					}
+		}
+
+		std::size_t count = 0;
+		for (std::size_t b = 1; b < builders.size(); ++b) {
+			for (std::size_t v = 0; v != builders[b].vertices.size(); ++v) {
+				if (clustered.count(Vertex_handle(b, v)))continue;
+				Point_3& vertex = builders[b].vertices[v];
+				auto found = grid.find(get_cell(CGAL::to_double(vertex.x()), CGAL::to_double(vertex.y()), CGAL::to_double(vertex.z()), cell_size));
+				if (found == grid.end())continue;
+
+				// only snap to buildings with a smaller index, so the walls are not moved towards each other
+				bool snapped = false;
+				Point_3 nearest;
+				Kernel::FT nearest_distance = 0;
+				for (const auto& h : found->second) {
+					if (h.first >= b)break; // sorted by building
+					Point_3 projected;
+					if (!project_to_face(vertex, builders[h.first].vertices, builders[h.first].faces[h.second], projected))continue;
+					Kernel::FT d = CGAL::squared_distance(vertex, projected);
+					if (!snapped || d < nearest_distance) {
+						nearest = projected;
+						nearest_distance = d;
+						snapped = true;
+					}
+				}
+				if (snapped) {
+					vertex = nearest;
+					++count;
+				}
+			}
+		}
+		return count;
+	}
+
+
+
+	/*
+	* project a point onto a triangle if the point is within the tolerance of the triangle
+	* the projection is exact (EPECK), the projected point lies exactly on the supporting plane of the triangle
+	*
+	* @param:
+	* point    : the point
+	* vertices : vertices of the face's building
+	* face     : the face (a triangle after triangulate()), indices in vertices
+	* projected: the projected point
+	* @return:
+	* true if the point is snapped (not on the plane, distance <= tolerance and the projection lies inside the triangle)
+	*/
+	bool project_to_face(const Point_3& point, const std::vector<Point_3>& vertices, const std::vector<unsigned long>& face, Point_3& projected) const
+	{
+		if (face.size() != 3)return false; // not triangulated
+		const Point_3& a = vertices[face[0]];
+		const Point_3& b = vertices[face[1]];
+		const Point_3& c = vertices[face[2]];
+		if (CGAL::collinear(a, b, c))return false; // degenerate face
+
+		Kernel::Plane_3 plane(a, b, c);
+		if (plane.has_on(point))return false; // already on the plane
+		if (CGAL::squared_distance(point, plane) > Kernel::FT(tolerance * tolerance))return false;
+
+		projected = plane.projection(point);
+		return Kernel::Triangle_3(a, b, c).has_on(projected);
+	}
+
+
+
+	/*
+	* get the grid cell of a point, cell size = tolerance (vertex - vertex) or size (vertex - face)
+	*/
+	Cell get_cell(const Point_3& p) const
+	{
+		return get_cell(CGAL::to_double(p.x()), CGAL::to_double(p.y()), CGAL::to_double(p.z()), tolerance);
+	}
+
+	static Cell get_cell(double x, double y, double z, double size)
+	{
+		return Cell((long long)std::floor(x / size), (long long)std::floor(y / size), (long long)std::floor(z / size));
+	}
+
+
+
+	/*
+	* squared distance of two points (inexact, for comparing with the tolerance only)
+	*/
+	static double squared_distance(const Point_3& p, const Point_3& q)
+	{
+		double dx = CGAL::to_double(p.x()) - CGAL::to_double(q.x());
+		double dy = CGAL::to_double(p.y()) - CGAL::to_double(q.y());
+		double dz = CGAL::to_double(p.z()) - CGAL::to_double(q.z());
+		return dx * dx + dy * dy + dz * dz;
+	}
+
+
+
+protected:
+
+	double tolerance;
+	std::vector<Polyhedron_builder<Polyhedron::HalfedgeDS>> builders; // vertices and faces of each building
+	std::vector<std::string> ids; // building id of each builder
+	std::set<Vertex_handle> clustered; // vertices snapped (or snapped to) in the vertex - vertex snapping
+};
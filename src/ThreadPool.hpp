@@ -0,0 +1,322 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory> // for std::unique_ptr, std::shared_ptr
+#include <functional> // for std::function
+#include <future> // for std::packaged_task, std::future
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <map>
+
+
+
+/*
+* class for a fixed-size work-stealing thread pool
+*
+* std::async(std::launch::async, ...) starts one thread per task, for a block of 50 buildings
+* 50 minkowski sums run at the same time: the cores are oversubscribed and 50 working sets are held in memory
+*
+* the pool starts a fixed number of worker threads, each with its own task queue, and one shared queue:
+* - a task submitted from a worker goes to the back of the worker's own queue
+* - a task submitted from outside goes to the back of the shared queue
+* - a worker takes tasks from the front of its own queue, then from the front of the shared queue
+*   and when it runs out of tasks it steals from the front of the other queues
+* all queues are FIFO, thus the tasks start in the order they are submitted
+* (e.g. the longest-first order of Cost::schedule())
+*
+* at most size() tasks run at the same time, thus the memory is bounded by the working sets of size() tasks
+* and the per-thread state (e.g. the thread_local cube cache in NefProcessing::get_cube()) is reused by the tasks
+*
+* a worker waiting for a task (wait()) runs the pending tasks of the same group meanwhile,
+* thus tasks can submit and wait for other tasks without deadlocking the pool,
+* when none of them is pending it sleeps until the task is done or a task of the group is submitted
+* a thread outside the pool (e.g. main) never runs tasks, it only sleeps in wait()
+* the group is any address identifying the tasks of one caller (e.g. an Executor, the futures of one batch),
+* a waiting block task only runs its own buildings and never a whole other block nested on its stack,
+* thus at most size() blocks (and their intermediates) are alive at the same time
+*
+* usage:
+* ThreadPool pool(threads);                                   // 0 -> std::thread::hardware_concurrency()
+* std::future<void> future = pool.submit([]() {...}, group);  // group: nullptr by default
+* pool.wait(future, group);                                   // or future.get() outside the pool
+*/
+class ThreadPool
+{
+public:
+
+	/*
+	* @param:
+	* threads: number of worker threads, 0 -> std::thread::hardware_concurrency()
+	*/
+	explicit ThreadPool(std::size_t threads = 0)
+	{
+		if (threads == 0)threads = std::thread::hardware_concurrency();
+		if (threads == 0)threads = 1; // hardware_concurrency() may return 0
+
+		for (std::size_t i = 0; i != threads; ++i)queues.emplace_back(new Queue);
+		for (std::size_t i = 0; i != threads; ++i)workers.emplace_back([this, i]() { work(i); });
+	}
+
+
+
+	/*
+	* the pending tasks are finished before the workers are joined
+	*/
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+			stopping = true;
+		}
+		sleep_condition.notify_all();
+		for (auto& worker : workers)worker.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+
+
+	typedef const void* Group; // identifies the tasks a waiting thread may run, see wait()
+
+
+
+	/*
+	* submit a task
+	* an exception thrown by the task is stored in the future and rethrown by get()
+	*/
+	template<class F>
+	std::future<void> submit(F&& task, Group group = nullptr)
+	{
+		auto packaged = std::make_shared<std::packaged_task<void()>>(std::forward<F>(task));
+		std::future<void> future = packaged->get_future();
+
+		Queue& queue = (current_pool == this) ? *queues[current_index] : shared;
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.tasks.push_back({ [this, packaged, group]() { (*packaged)(); done(group); }, group });
+			std::lock_guard<std::mutex> sleep_lock(sleep_mutex); // counted before the task can be taken
+			++pending;
+			Group_state& state = groups[group];
+			++state.pending;
+			state.condition.notify_all(); // a waiter of the group can run it
+		}
+		sleep_condition.notify_one();
+		return future;
+	}
+
+
+
+	/*
+	* wait until the future is ready, a worker runs the pending tasks of the group meanwhile
+	* (the future must belong to a task of the group)
+	* rethrows the exception of the task, if any
+	*/
+	void wait(std::future<void>& future, Group group = nullptr)
+	{
+		if (current_pool != this) { // outside the pool, at most size() tasks run at the same time
+			future.get();
+			return;
+		}
+
+		auto ready = [&future]() { return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready; };
+		while (!ready()) {
+			if (run_pending(group))continue;
+
+			// all tasks of the group are running, sleep until one of them is done or a new one is submitted
+			std::unique_lock<std::mutex> lock(sleep_mutex);
+			Group_state& state = groups[group];
+			++state.waiters;
+			state.condition.wait(lock, [&state, &ready]() { return state.pending != 0 || ready(); });
+			--state.waiters;
+			release(group);
+		}
+		future.get();
+	}
+
+
+
+	/*
+	* run one pending task of the group in the calling worker, for a worker waiting on something else than a future
+	* return false if there is no pending task of the group, always false outside the pool
+	*/
+	bool run_pending(Group group = nullptr)
+	{
+		if (current_pool != this)return false; // at most size() tasks run at the same time
+		Task task;
+		if (!take(current_index, task, &group))return false;
+		task.function();
+		return true;
+	}
+
+
+
+	/*
+	* wait for all the futures, see wait()
+	* the first exception is rethrown after all the futures are ready
+	*/
+	void wait_all(std::vector<std::future<void>>& futures, Group group = nullptr)
+	{
+		std::exception_ptr exception;
+		for (auto& future : futures) {
+			try {
+				wait(future, group);
+			}
+			catch (...) {
+				if (!exception)exception = std::current_exception();
+			}
+		}
+		futures.clear();
+		if (exception)std::rethrow_exception(exception);
+	}
+
+
+
+	/*
+	* number of worker threads
+	*/
+	std::size_t size() const
+	{
+		return workers.size();
+	}
+
+
+
+protected:
+
+	struct Task
+	{
+		std::function<void()> function;
+		Group group;
+	};
+
+	/*
+	* the queued tasks and the waiting workers of one group, guarded by sleep_mutex
+	*/
+	struct Group_state
+	{
+		std::size_t pending = 0; // number of queued tasks of the group
+		std::size_t waiters = 0; // number of workers sleeping in wait()
+		std::condition_variable condition;
+	};
+
+	/*
+	* task queue of one worker
+	*/
+	struct Queue
+	{
+		std::deque<Task> tasks;
+		std::mutex mutex;
+	};
+
+
+
+	/*
+	* loop of the worker threads
+	*/
+	void work(std::size_t index)
+	{
+		current_pool = this;
+		current_index = index;
+
+		while (true) {
+			Task task;
+			if (take(index, task)) {
+				task.function();
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(sleep_mutex);
+			if (pending == 0 && stopping)return;
+			sleep_condition.wait(lock, [this]() { return pending != 0 || stopping; });
+		}
+	}
+
+
+
+	/*
+	* take a task: the front of the own queue first, then the front of the shared queue, otherwise steal the front of the other queues
+	* index: the own queue
+	* group: only a task of this group, nullptr -> any task (a worker without a task)
+	* return false if there is no such task
+	*/
+	bool take(std::size_t index, Task& task, const Group* group = nullptr)
+	{
+		if (take_front(*queues[index], task, group))return true;
+		if (take_front(shared, task, group))return true;
+
+		for (std::size_t i = 1; i <= queues.size(); ++i) {
+			std::size_t victim = (index + i) % (queues.size() + 1); // queues.size() is the shared queue, already tried
+			if (victim == queues.size() || victim == index)continue;
+			if (take_front(*queues[victim], task, group))return true;
+		}
+		return false;
+	}
+
+	/*
+	* take the first task (of the group) of a queue
+	*/
+	bool take_front(Queue& queue, Task& task, const Group* group)
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		auto it = queue.tasks.begin();
+		if (group != nullptr) {
+			while (it != queue.tasks.end() && it->group != *group)++it;
+		}
+		if (it == queue.tasks.end())return false;
+		task = std::move(*it);
+		queue.tasks.erase(it);
+		taken(task.group);
+		return true;
+	}
+
+	void taken(Group group)
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		--pending;
+		--groups[group].pending;
+		release(group);
+	}
+
+	/*
+	* a task of the group is done, wake up the waiters of the group (the future is ready)
+	*/
+	void done(Group group)
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		auto found = groups.find(group);
+		if (found != groups.end())found->second.condition.notify_all();
+	}
+
+	/*
+	* remove the state of a group without queued tasks and waiters, sleep_mutex is locked
+	*/
+	void release(Group group)
+	{
+		auto found = groups.find(group);
+		if (found != groups.end() && found->second.pending == 0 && found->second.waiters == 0)groups.erase(found);
+	}
+
+
+
+protected:
+
+	std::vector<std::unique_ptr<Queue>> queues; // one queue for each worker
+	Queue shared; // the tasks submitted from outside the pool
+	std::vector<std::thread> workers;
+
+	std::mutex sleep_mutex; // guards pending, stopping and groups, for the idle and the waiting workers
+	std::condition_variable sleep_condition;
+	std::size_t pending = 0; // number of queued tasks
+	bool stopping = false;
+	std::map<Group, Group_state> groups; // the groups with queued tasks or waiting workers
+
+	static thread_local ThreadPool* current_pool; // the pool the current thread works for, nullptr outside
+	static thread_local std::size_t current_index; // the queue of the current worker
+};
+
+inline thread_local ThreadPool* ThreadPool::current_pool = nullptr;
+inline thread_local std::size_t ThreadPool::current_index = 0;
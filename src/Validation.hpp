@@ -0,0 +1,157 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <mutex> // for std::mutex
+#include <atomic> // for the sampling counter
+
+
+
+/*
+* namespace Validation -> controls the validity checks of the CGAL objects
+*
+* is_valid() / is_simple() are full structural traversals of a Nef_polyhedron (or a mesh)
+* running them on every building is expensive and only useful when debugging
+* thus the checks are switched on / off by a validation level:
+*
+* OFF     - no check is performed at all (production runs)
+* SAMPLED - only every n-th check is performed (n = sample_interval)
+* FULL    - every check is performed (debug runs)
+*
+* the results are recorded in a report (instead of printed to the console)
+* the report can be written to a file after processing
+*/
+namespace Validation {
+
+
+enum class Level { OFF, SAMPLED, FULL };
+
+
+/*
+* one record of the report
+* check : which check is performed, e.g. "nef is_valid"
+* object: which object is checked, e.g. the building id or the output file
+* passed: result of the check
+*/
+struct Entry
+{
+  std::string check;
+  std::string object;
+  bool passed;
+};
+
+
+#ifdef NDEBUG
+Level level = Level::OFF; // release build -> skip the traversals by default
+#else
+Level level = Level::FULL; // debug build -> keep the full checks by default
+#endif
+unsigned int sample_interval = 10; // for SAMPLED level: perform one check out of sample_interval checks
+
+std::vector<Entry> report; // store the results of the performed checks
+std::mutex report_mutex; // for thread-safety, checks can be performed in multi threading process
+std::atomic<unsigned long> check_count(0); // for sampling
+
+
+
+/*
+* get the level from a string: "off", "sampled" or "full"
+* unknown strings fall back to OFF
+*/
+Level get_level(const std::string& level_string)
+{
+  if (level_string == "full")return Level::FULL;
+  if (level_string == "sampled")return Level::SAMPLED;
+  return Level::OFF;
+}
+
+
+
+/*
+* get the string of the current level, used for printing the parameters
+*/
+std::string get_level_string()
+{
+  switch (level) {
+  case Level::FULL: return "full";
+  case Level::SAMPLED: return "sampled";
+  default: return "off";
+  }
+}
+
+
+
+/*
+* decide whether the next check should be performed according to the level
+* call this function before a check and only do the traversal if it returns true
+*/
+bool should_check()
+{
+  switch (level) {
+  case Level::FULL:
+	return true;
+  case Level::SAMPLED:
+	return (check_count++ % (sample_interval == 0 ? 1 : sample_interval)) == 0;
+  default:
+	return false;
+  }
+}
+
+
+
+/*
+* add a result to the report
+*/
+void record(const std::string& check, const std::string& object, bool passed)
+{
+  std::lock_guard<std::mutex> lock(report_mutex);
+  report.push_back({ check, object, passed });
+}
+
+
+
+/*
+* number of failed checks in the report
+*/
+std::size_t failed_count()
+{
+  std::lock_guard<std::mutex> lock(report_mutex);
+  std::size_t count = 0;
+  for (const auto& entry : report) {
+	if (!entry.passed)++count;
+  }
+  return count;
+}
+
+
+
+/*
+* write the report to a txt file, one check per line:
+* check	object	passed / failed
+* return true if successful otherwise false
+*/
+bool write_report(const std::string& filename)
+{
+  std::ofstream out(filename);
+  if (!out.is_open()) {
+	std::cerr << "Error: Unable to open validation report \"" << filename << "\" for writing!" << std::endl;
+	return false;
+  }
+
+  std::lock_guard<std::mutex> lock(report_mutex);
+  std::size_t failed = 0;
+  for (const auto& entry : report) {
+	out << entry.check << '\t' << entry.object << '\t' << (entry.passed ? "passed" : "failed") << '\n';
+	if (!entry.passed)++failed;
+  }
+  out.close();
+
+  std::cout << "validation: " << report.size() << " checks performed, " << failed << " failed\n";
+  std::cout << "report saved at: " << filename << '\n';
+  return true;
+}
+
+
+};
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <map>
+#include <tuple>
+#include <algorithm>
+
+#include "Polyhedron.hpp"
+
+
+
+/*
+* sparse voxel engine - fast approximate blocks
+*
+* the solids are rasterized into a sparse voxel grid and the gaps are closed by morphological closing
+* (dilation followed by erosion) with a cube of the minkowski size as structuring element
+* the runtime is bounded by the number of voxels, not by the geometric complexity of the buildings
+*
+* the grid is stored column-wise: for each (i, j) column only the runs of filled voxels along z are stored
+* runs  : sorted, disjoint, half-open [k0, k1), voxel k covers [k * size, (k + 1) * size) in z
+* thus a solid block of n * n * n voxels costs n * n runs instead of n^3 voxels
+*
+* the surface is extracted as the voxel (cuboid) faces between filled and empty voxels,
+* all the vertices are grid points and all the faces are unit squares, thus the surface is watertight
+* (note: voxels only touching along an edge give a non-manifold edge)
+*
+* usage:
+* Voxel voxel(resolution);
+* voxel.add(jhandle);                 // for each building
+* voxel.close(minkowski_param);       // closing with the structuring size
+* voxel.extract(shell);               // surface to a Shell_explorer, see FileIO::write_JSON() / FileIO::write_OFF()
+*/
+class Voxel
+{
+public:
+
+	typedef std::pair<long long, long long> Column_key; // (i, j)
+	typedef std::vector<std::pair<long long, long long>> Runs; // [k0, k1) along z
+
+
+
+	/*
+	* @param:
+	* resolution: side length of one voxel
+	*/
+	Voxel(double resolution = 0.25) : resolution(resolution) {}
+
+
+
+	/*
+	* rasterize one building
+	* a voxel is filled if its center is inside the solid (parity of the crossings of a vertical ray through the center)
+	*
+	* @return:
+	* false if the building can not be read (see Build::get_polyhedron_builder())
+	*/
+	bool add(const JsonHandler& jhandle)
+	{
+		Polyhedron_builder<Polyhedron::HalfedgeDS> polyhedron_builder;
+		if (!Build::get_polyhedron_builder(jhandle, polyhedron_builder))return false;
+
+		const auto& vertices = polyhedron_builder.vertices;
+		std::map<Column_key, std::vector<double>> crossings; // z of the crossings in each column
+
+		for (const auto& face : polyhedron_builder.faces) {
+			if (face.size() < 3)continue;
+
+			std::vector<double> xs, ys, zs;
+			for (auto index : face) {
+				xs.push_back(CGAL::to_double(vertices[index].x()));
+				ys.push_back(CGAL::to_double(vertices[index].y()));
+				zs.push_back(CGAL::to_double(vertices[index].z()));
+			}
+
+			// plane of the face - Newell's method
+			double nx = 0, ny = 0, nz = 0;
+			for (std::size_t a = 0, b = 1; a != face.size(); ++a, b = (a + 1) % face.size()) {
+				nx += (ys[a] - ys[b]) * (zs[a] + zs[b]);
+				ny += (zs[a] - zs[b]) * (xs[a] + xs[b]);
+				nz += (xs[a] - xs[b]) * (ys[a] + ys[b]);
+			}
+			double length = std::sqrt(nx * nx + ny * ny + nz * nz);
+			if (length < epsilon || std::abs(nz) < 1e-9 * length)continue; // degenerate or vertical face, never crossed
+
+			// columns whose center can be inside the face
+			long long i0 = (long long)std::ceil(*std::min_element(xs.begin(), xs.end()) / resolution - 0.5);
+			long long i1 = (long long)std::floor(*std::max_element(xs.begin(), xs.end()) / resolution - 0.5);
+			long long j0 = (long long)std::ceil(*std::min_element(ys.begin(), ys.end()) / resolution - 0.5);
+			long long j1 = (long long)std::floor(*std::max_element(ys.begin(), ys.end()) / resolution - 0.5);
+
+			for (long long i = i0; i <= i1; ++i)
+				for (long long j = j0; j <= j1; ++j) {
+					double x = (i + 0.5) * resolution;
+					double y = (j + 0.5) * resolution;
+
+					// point in polygon (xy projection), half-open rule so a shared edge is counted once
+					bool inside = false;
+					for (std::size_t a = 0, b = face.size() - 1; a != face.size(); b = a++) {
+						if ((ys[a] > y) != (ys[b] > y) && x < (xs[b] - xs[a]) * (y - ys[a]) / (ys[b] - ys[a]) + xs[a]) {
+							inside = !inside;
+						}
+					}
+					if (!inside)continue;
+
+					double z = zs[0] - (nx * (x - xs[0]) + ny * (y - ys[0])) / nz;
+					crossings[Column_key(i, j)].push_back(z);
+				}
+		}
+
+		// fill the voxels between each pair of crossings
+		for (auto& column : crossings) {
+			auto& zs = column.second;
+			std::sort(zs.begin(), zs.end());
+
+			Runs& runs = columns[column.first];
+			for (std::size_t c = 0; c + 1 < zs.size(); c += 2) {
+				long long k0 = (long long)std::ceil(zs[c] / resolution - 0.5);
+				long long k1 = (long long)std::ceil(zs[c + 1] / resolution - 0.5);
+				if (k1 > k0)runs.emplace_back(k0, k1);
+			}
+			normalize(runs);
+			if (runs.empty())columns.erase(column.first);
+		}
+
+		return true;
+	}
+
+
+
+	/*
+	* morphological closing with a cube of the given size
+	* dilation with [0, r]^3 (the same direction as minkowski sum with the cube [0, size]^3) followed by
+	* erosion with the same structuring element, r = size / resolution (rounded up)
+	* gaps narrower than the structuring size are filled, the outer extent is kept
+	*/
+	void close(double size)
+	{
+		long long r = (long long)std::ceil(size / resolution - epsilon);
+		if (r <= 0)return;
+
+		std::cout << "voxel closing, structuring size: " << r << " voxels ...\n";
+		dilate(r);
+		erode(r);
+		std::cout << "done\n";
+	}
+
+
+
+	/*
+	* extract the boundary faces of the filled voxels
+	*
+	* @param:
+	* shell: vertices and faces (and cleaned_vertices, cleaned_faces) will be stored in this shell
+	*/
+	void extract(Shell_explorer& shell) const
+	{
+		std::map<std::tuple<long long, long long, long long>, unsigned long> vertex_index;
+		std::vector<Point_3> vertices;
+		std::vector<std::vector<unsigned long>> faces;
+
+		auto get_index = [this, &vertex_index, &vertices](long long i, long long j, long long k) {
+			auto inserted = vertex_index.emplace(std::make_tuple(i, j, k), (unsigned long)vertices.size());
+			if (inserted.second)vertices.emplace_back(i * resolution, j * resolution, k * resolution);
+			return inserted.first->second;
+		};
+
+		const Runs empty;
+		auto get_runs = [this, &empty](long long i, long long j) -> const Runs& {
+			auto found = columns.find(Column_key(i, j));
+			return found == columns.end() ? empty : found->second;
+		};
+
+		for (const auto& column : columns) {
+			long long i = column.first.first;
+			long long j = column.first.second;
+
+			// bottom and top faces
+			for (const auto& run : column.second) {
+				long long k0 = run.first, k1 = run.second;
+				faces.push_back({ get_index(i, j, k0), get_index(i, j + 1, k0), get_index(i + 1, j + 1, k0), get_index(i + 1, j, k0) });
+				faces.push_back({ get_index(i, j, k1), get_index(i + 1, j, k1), get_index(i + 1, j + 1, k1), get_index(i, j + 1, k1) });
+			}
+
+			// walls, where the neighbouring column is empty, one face per voxel so that the surface stays conforming
+			for (const auto& run : difference(column.second, get_runs(i + 1, j))) // facing +x
+				for (long long k = run.first; k != run.second; ++k)
+					faces.push_back({ get_index(i + 1, j, k), get_index(i + 1, j + 1, k), get_index(i + 1, j + 1, k + 1), get_index(i + 1, j, k + 1) });
+			for (const auto& run : difference(column.second, get_runs(i - 1, j))) // facing -x
+				for (long long k = run.first; k != run.second; ++k)
+					faces.push_back({ get_index(i, j, k), get_index(i, j, k + 1), get_index(i, j + 1, k + 1), get_index(i, j + 1, k) });
+			for (const auto& run : difference(column.second, get_runs(i, j + 1))) // facing +y
+				for (long long k = run.first; k != run.second; ++k)
+					faces.push_back({ get_index(i, j + 1, k), get_index(i, j + 1, k + 1), get_index(i + 1, j + 1, k + 1), get_index(i + 1, j + 1, k) });
+			for (const auto& run : difference(column.second, get_runs(i, j - 1))) // facing -y
+				for (long long k = run.first; k != run.second; ++k)
+					faces.push_back({ get_index(i, j, k), get_index(i + 1, j, k), get_index(i + 1, j, k + 1), get_index(i, j, k + 1) });
+		}
+
+		std::cout << "voxel surface: " << vertices.size() << " vertices, " << faces.size() << " faces\n";
+
+		shell.vertices = vertices;
+		shell.faces = faces;
+		shell.cleaned_vertices = vertices;
+		shell.cleaned_faces = faces;
+	}
+
+
+
+	/*
+	* number of filled voxels
+	*/
+	std::size_t number_of_voxels() const
+	{
+		std::size_t count = 0;
+		for (const auto& column : columns)
+			for (const auto& run : column.second)count += (std::size_t)(run.second - run.first);
+		return count;
+	}
+
+
+
+protected:
+
+	/*
+	* dilation with [0, r]^3, separable: z, x, y
+	*/
+	void dilate(long long r)
+	{
+		for (auto& column : columns) {
+			for (auto& run : column.second)run.second += r;
+			normalize(column.second);
+		}
+
+		for (int axis = 0; axis != 2; ++axis) {
+			std::map<Column_key, Runs> dilated;
+			for (const auto& column : columns)
+				for (long long b = 0; b <= r; ++b) {
+					Column_key key = shift(column.first, axis, b);
+					Runs& runs = dilated[key];
+					runs.insert(runs.end(), column.second.begin(), column.second.end());
+				}
+			for (auto& column : dilated)normalize(column.second);
+			columns.swap(dilated);
+		}
+	}
+
+
+
+	/*
+	* erosion with [0, r]^3, separable: z, x, y
+	* a voxel is kept if all the voxels of the structuring element placed at it are filled
+	*/
+	void erode(long long r)
+	{
+		for (auto& column : columns) {
+			for (auto& run : column.second)run.second -= r;
+			normalize(column.second);
+		}
+
+		for (int axis = 0; axis != 2; ++axis) {
+			std::map<Column_key, Runs> eroded;
+			for (const auto& column : columns) {
+				Runs runs = column.second;
+				for (long long b = 1; b <= r && !runs.empty(); ++b) {
+					auto found = columns.find(shift(column.first, axis, b));
+					if (found == columns.end())runs.clear();
+					else runs = intersection(runs, found->second);
+				}
+				if (!runs.empty())eroded.emplace(column.first, runs);
+			}
+			columns.swap(eroded);
+		}
+	}
+
+
+
+	/*
+	* shift a column key along x (axis = 0) or y (axis = 1)
+	*/
+	static Column_key shift(const Column_key& key, int axis, long long offset)
+	{
+		return axis == 0 ? Column_key(key.first + offset, key.second) : Column_key(key.first, key.second + offset);
+	}
+
+
+
+	/*
+	* sort the runs, merge overlapping or touching runs and drop empty runs
+	*/
+	static void normalize(Runs& runs)
+	{
+		runs.erase(std::remove_if(runs.begin(), runs.end(), [](const std::pair<long long, long long>& run) {
+			return run.second <= run.first; }), runs.end());
+		std::sort(runs.begin(), runs.end());
+
+		Runs merged;
+		for (const auto& run : runs) {
+			if (!merged.empty() && run.first <= merged.back().second)merged.back().second = std::max(merged.back().second, run.second);
+			else merged.push_back(run);
+		}
+		runs.swap(merged);
+	}
+
+
+
+	/*
+	* intersection of two normalized runs
+	*/
+	static Runs intersection(const Runs& a, const Runs& b)
+	{
+		Runs result;
+		std::size_t p = 0, q = 0;
+		while (p != a.size() && q != b.size()) {
+			long long k0 = std::max(a[p].first, b[q].first);
+			long long k1 = std::min(a[p].second, b[q].second);
+			if (k1 > k0)result.emplace_back(k0, k1);
+			if (a[p].second < b[q].second)++p;
+			else ++q;
+		}
+		return result;
+	}
+
+
+
+	/*
+	* difference a \ b of two normalized runs
+	*/
+	static Runs difference(const Runs& a, const Runs& b)
+	{
+		Runs result;
+		std::size_t q = 0;
+		for (const auto& run : a) {
+			long long k0 = run.first;
+			while (q != b.size() && b[q].second <= k0)++q;
+			for (std::size_t t = q; t != b.size() && b[t].first < run.second; ++t) {
+				if (b[t].first > k0)result.emplace_back(k0, b[t].first);
+				k0 = std::max(k0, b[t].second);
+			}
+			if (run.second > k0)result.emplace_back(k0, run.second);
+		}
+		return result;
+	}
+
+
+
+protected:
+
+	double resolution;
+	std::map<Column_key, Runs> columns; // the sparse grid, only non-empty columns are stored
+};
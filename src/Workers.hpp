@@ -0,0 +1,443 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <functional> // for std::function
+#include <sstream>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread> // for std::thread::hardware_concurrency()
+#include <algorithm>
+#include <cstdint>
+
+#include "Polyhedron.hpp"
+#include <CGAL/IO/Nef_polyhedron_iostream_3.h> // for passing nefs to the worker processes
+
+#if defined(__unix__) || defined(__APPLE__)
+#define GEOCFD_KILLABLE_HELPER
+#include <unistd.h> // for fork(), read(), write()
+#include <signal.h> // for kill()
+#include <poll.h> // for poll()
+#include <sys/socket.h> // for socketpair(), sendmsg(), recvmsg()
+#include <cerrno>
+#endif
+
+
+
+/*
+* namespace Workers -> a pool of worker processes for the tasks on a single building
+*
+* a task in a worker process can be killed (time budget) and a segfault inside CGAL only kills the worker,
+* but a process forked from a multi-threaded process may only call async-signal-safe functions:
+* a lock held by another thread at the time of fork() (allocator, static initialisation, mutexes) never gets released in the child
+*
+* thus no process is forked after the threads are started:
+* start() is called while the program is single-threaded and forks a fork server,
+* the fork server forks the workers (at start and whenever a worker has to be replaced) and
+* passes their sockets to the main process (SCM_RIGHTS)
+*
+* a task is identified by a job (registered with add_job() at static initialisation, thus the ids are the same in all processes),
+* its parameters and its input nef, the nefs are serialized (Nef_polyhedron_iostream_3) over the socket
+* the main process waits for the result with poll() until the timeout, a worker exceeding it is killed and replaced
+*
+* usage:
+* int job = Workers::add_job([](const Nef_polyhedron& nef, const std::vector<double>& params, Nef_polyhedron& result) {...});
+* Workers::start(count);                                     // before any thread is started
+* Workers::Result r = Workers::run(job, nef, params, timeout, result); // from any thread
+*/
+namespace Workers {
+
+
+typedef std::function<bool(const Nef_polyhedron&, const std::vector<double>&, Nef_polyhedron&)> Job;
+
+enum class Result { SUCCESS, FAILED, TIMED_OUT, CRASHED };
+
+
+
+/*
+* the registered jobs, the index is the id of the job
+*/
+std::vector<Job>& get_jobs()
+{
+  static std::vector<Job> jobs;
+  return jobs;
+}
+
+
+
+/*
+* register a job, at static initialisation (before start())
+* return the id of the job
+*/
+int add_job(const Job& job)
+{
+  get_jobs().push_back(job);
+  return (int)get_jobs().size() - 1;
+}
+
+
+
+#ifdef GEOCFD_KILLABLE_HELPER
+
+
+/*
+* one worker process, seen from the main process
+*/
+struct Worker
+{
+  pid_t pid = -1;
+  int fd = -1; // socket to the worker
+};
+
+
+int server_fd = -1; // socket to the fork server, guarded by server_mutex
+std::mutex server_mutex;
+
+std::vector<Worker> idle; // workers waiting for a task, guarded by mutex
+std::size_t count = 0; // number of workers (idle and busy), guarded by mutex
+std::mutex mutex;
+std::condition_variable condition;
+
+
+
+/*
+* read / write exactly size bytes, return false at the end of the stream or on error
+* the read waits until the deadline (without deadline if it is not set)
+*/
+bool write_all(int fd, const void* data, std::size_t size)
+{
+  const char* p = (const char*)data;
+  while (size != 0) {
+	ssize_t n = write(fd, p, size);
+	if (n == -1 && errno == EINTR)continue;
+	if (n <= 0)return false;
+	p += n;
+	size -= (std::size_t)n;
+  }
+  return true;
+}
+
+bool read_all(int fd, void* data, std::size_t size,
+  const std::chrono::steady_clock::time_point* deadline = nullptr, bool* timed_out = nullptr)
+{
+  char* p = (char*)data;
+  while (size != 0) {
+	if (deadline != nullptr) {
+	  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(*deadline - std::chrono::steady_clock::now()).count();
+	  if (left <= 0) {
+		if (timed_out != nullptr)*timed_out = true;
+		return false;
+	  }
+	  pollfd pfd = { fd, POLLIN, 0 };
+	  int ready = poll(&pfd, 1, (int)std::min<long long>(left, 1000 * 60)); // blocks until data arrives or the time is up
+	  if (ready == -1 && errno == EINTR)continue;
+	  if (ready == -1)return false;
+	  if (ready == 0)continue; // check the deadline again
+	}
+	ssize_t n = read(fd, p, size);
+	if (n == -1 && errno == EINTR)continue;
+	if (n <= 0)return false;
+	p += n;
+	size -= (std::size_t)n;
+  }
+  return true;
+}
+
+bool write_string(int fd, const std::string& s)
+{
+  std::uint64_t size = s.size();
+  return write_all(fd, &size, sizeof(size)) && write_all(fd, s.data(), s.size());
+}
+
+bool read_string(int fd, std::string& s,
+  const std::chrono::steady_clock::time_point* deadline = nullptr, bool* timed_out = nullptr)
+{
+  std::uint64_t size = 0;
+  if (!read_all(fd, &size, sizeof(size), deadline, timed_out))return false;
+  s.resize((std::size_t)size);
+  return size == 0 || read_all(fd, &s[0], (std::size_t)size, deadline, timed_out);
+}
+
+
+
+/*
+* the loop of a worker process: read a task, run it, write the result, until the main process closes the socket
+* request : job (int32), number of parameters (uint64), parameters (double), nef (string)
+* response: success (int32), result nef (string)
+*/
+void serve(int fd)
+{
+  while (true) {
+	std::int32_t job = 0;
+	std::uint64_t n = 0;
+	if (!read_all(fd, &job, sizeof(job)) || !read_all(fd, &n, sizeof(n)))_exit(0);
+	std::vector<double> params((std::size_t)n);
+	std::string input;
+	if ((n != 0 && !read_all(fd, params.data(), sizeof(double) * params.size())) || !read_string(fd, input))_exit(0);
+
+	std::int32_t success = 0;
+	std::string output;
+	try {
+	  Nef_polyhedron nef;
+	  std::istringstream in(input);
+	  in >> nef;
+	  Nef_polyhedron result;
+	  if (!in.fail() && job >= 0 && job < (std::int32_t)get_jobs().size() && get_jobs()[job](nef, params, result)) {
+		std::ostringstream out;
+		out << result;
+		output = out.str();
+		success = 1;
+	  }
+	}
+	catch (...) {}
+
+	std::cout.flush();
+	if (!write_all(fd, &success, sizeof(success)) || !write_string(fd, output))_exit(0);
+  }
+}
+
+
+
+/*
+* pass a socket (and the pid of its worker) over a unix socket, fd -1 -> no socket
+*/
+bool send_worker(int socket_fd, int fd, pid_t pid)
+{
+  msghdr msg = {};
+  iovec iov = { &pid, sizeof(pid) };
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  char control[CMSG_SPACE(sizeof(int))] = {};
+  if (fd != -1) {
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	*(int*)CMSG_DATA(cmsg) = fd;
+  }
+  return sendmsg(socket_fd, &msg, 0) == (ssize_t)sizeof(pid);
+}
+
+bool receive_worker(int socket_fd, Worker& worker)
+{
+  msghdr msg = {};
+  pid_t pid = -1;
+  iovec iov = { &pid, sizeof(pid) };
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  char control[CMSG_SPACE(sizeof(int))] = {};
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t n;
+  do { n = recvmsg(socket_fd, &msg, 0); } while (n == -1 && errno == EINTR);
+  if (n != (ssize_t)sizeof(pid) || pid == -1)return false;
+
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS)return false;
+  worker.pid = pid;
+  worker.fd = *(int*)CMSG_DATA(cmsg);
+  return true;
+}
+
+
+
+/*
+* the loop of the fork server: fork a worker for each request (one byte), until the main process closes the socket
+* the fork server is single-threaded, thus the workers can safely run any code
+*/
+void fork_server(int socket_fd)
+{
+  signal(SIGCHLD, SIG_IGN); // the workers are reaped automatically
+  char request;
+  while (read(socket_fd, &request, 1) == 1) {
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+	  send_worker(socket_fd, -1, -1);
+	  continue;
+	}
+
+	pid_t pid = fork();
+	if (pid == 0) {
+	  close(socket_fd);
+	  close(sv[0]);
+	  signal(SIGCHLD, SIG_DFL);
+	  serve(sv[1]);
+	  _exit(0);
+	}
+
+	close(sv[1]);
+	send_worker(socket_fd, pid == -1 ? -1 : sv[0], pid);
+	close(sv[0]); // the main process holds its own copy
+  }
+  _exit(0);
+}
+
+
+
+/*
+* ask the fork server for a new worker
+*/
+bool spawn(Worker& worker)
+{
+  std::lock_guard<std::mutex> lock(server_mutex);
+  if (server_fd == -1)return false;
+  char request = 1;
+  return write_all(server_fd, &request, 1) && receive_worker(server_fd, worker);
+}
+
+
+
+/*
+* kill a worker (hung or crashed) and replace it
+*/
+void replace(Worker worker)
+{
+  kill(worker.pid, SIGKILL); // reaped by the fork server
+  close(worker.fd);
+
+  Worker new_worker;
+  bool spawned = spawn(new_worker);
+  std::lock_guard<std::mutex> lock(mutex);
+  if (spawned)idle.push_back(new_worker);
+  else {
+	--count;
+	std::cerr << "can not replace a worker process, " << count << " workers left\n";
+  }
+  condition.notify_one();
+}
+
+
+
+/*
+* start the fork server and count workers
+* must be called while the program is single-threaded (before MT::get_pool() is used)
+* return false if the fork server can not be started, run() is not available then
+*/
+bool start(std::size_t workers)
+{
+  if (server_fd != -1)return true;
+  if (workers == 0)workers = std::thread::hardware_concurrency();
+  if (workers == 0)workers = 1;
+
+  signal(SIGPIPE, SIG_IGN); // a dead worker gives an error on write() instead of killing the main process
+
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+	std::cerr << "can not create the socket of the fork server\n";
+	return false;
+  }
+
+  std::cout.flush(); // the child inherits the buffer, avoid printing it twice
+  pid_t pid = fork();
+  if (pid == -1) {
+	close(sv[0]);
+	close(sv[1]);
+	std::cerr << "can not fork the fork server\n";
+	return false;
+  }
+  if (pid == 0) {
+	close(sv[0]);
+	fork_server(sv[1]);
+  }
+  close(sv[1]);
+  server_fd = sv[0];
+
+  for (std::size_t i = 0; i != workers; ++i) {
+	Worker worker;
+	if (!spawn(worker))break;
+	idle.push_back(worker);
+  }
+  count = idle.size();
+  if (count == 0) {
+	std::cerr << "can not start the worker processes\n";
+	return false;
+  }
+  return true;
+}
+
+
+
+/*
+* whether the workers are available
+*/
+bool started()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return count != 0;
+}
+
+
+
+/*
+* run a task in a worker process, waits for a free worker
+*
+* @param:
+* job    : see add_job()
+* nef    : the input nef
+* params : the parameters of the job
+* timeout: seconds, the worker is killed (and replaced) when it is exceeded
+* result : the result nef of the task
+* @return:
+* SUCCESS (result is set), FAILED (the job failed or no worker is available), TIMED_OUT, CRASHED (the worker died)
+*/
+Result run(int job, const Nef_polyhedron& nef, const std::vector<double>& params, double timeout, Nef_polyhedron& result)
+{
+  Worker worker;
+  {
+	std::unique_lock<std::mutex> lock(mutex);
+	condition.wait(lock, []() { return !idle.empty() || count == 0; });
+	if (count == 0)return Result::FAILED;
+	worker = idle.back();
+	idle.pop_back();
+  }
+
+  std::ostringstream out;
+  out << nef;
+  std::int32_t job_id = job;
+  std::uint64_t n = params.size();
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+  bool timed_out = false;
+  std::int32_t success = 0;
+  std::string output;
+  bool done =
+	write_all(worker.fd, &job_id, sizeof(job_id)) && write_all(worker.fd, &n, sizeof(n)) &&
+	(n == 0 || write_all(worker.fd, params.data(), sizeof(double) * params.size())) && write_string(worker.fd, out.str()) &&
+	read_all(worker.fd, &success, sizeof(success), &deadline, &timed_out) && read_string(worker.fd, output, &deadline, &timed_out);
+
+  if (!done) {
+	replace(worker);
+	return timed_out ? Result::TIMED_OUT : Result::CRASHED;
+  }
+
+  {
+	std::lock_guard<std::mutex> lock(mutex);
+	idle.push_back(worker);
+  }
+  condition.notify_one();
+
+  if (!success)return Result::FAILED;
+  std::istringstream in(output);
+  in >> result;
+  return in.fail() ? Result::FAILED : Result::SUCCESS;
+}
+
+
+#else
+
+
+bool start(std::size_t) { return false; }
+bool started() { return false; }
+Result run(int, const Nef_polyhedron&, const std::vector<double>&, double, Nef_polyhedron&) { return Result::FAILED; }
+
+
+#endif
+
+
+};
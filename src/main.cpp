@@ -8,6 +8,12 @@
 #include "JsonWriter.hpp"
 #include "cmdline.h" // for cmd line parser
 #include "MultiThread.hpp"
+#include "Dedup.hpp"
+#include "Extrusion.hpp"
+#include "Snap.hpp"
+#include "Voxel.hpp"
+#include "Bridge.hpp"
+#include "Pipeline.hpp"
 
 
 
@@ -38,9 +44,26 @@ int main(int argc, char* argv[])
   p.add<double>("lod", 'l', "lod level", false, 2.2, cmdline::oneof<double>(1.2, 1.3, 2.2)); // lod level, 2.2 by default
   p.add<double>("minkowski", 'm', "minkowski value", false, 0.01); // minkowski value, 0.01 by default
   p.add<double>("target edge length", 'e', "target edge length for remeshing", false, 3);
+  p.add<std::string>("engine", '\0', "minkowski engine: cgal, decomposition, extrusion (lod 1.2 / 1.3 only), voxel (approximate)", false, "cgal", cmdline::oneof<std::string>("cgal", "decomposition", "extrusion", "voxel")); // minkowski engine, cgal by default
+  p.add<std::string>("merge", '\0', "how the gaps between buildings are closed: minkowski, snap (snap vertices within the minkowski value, no minkowski sum), bridge (expand near-contact faces only)", false, "minkowski", cmdline::oneof<std::string>("minkowski", "snap", "bridge")); // merge mode, minkowski by default
+  p.add<double>("snap", '\0', "snap input vertices to a grid of this size, e.g. 0.001 (0: no snapping)", false, 0); // snap grid, no snapping by default
+  p.add<double>("voxel", '\0', "voxel size for the voxel engine", false, 0.25); // voxel size, 0.25 by default
+  p.add<int>("threads", '\0', "number of worker threads for multi threading (0: number of cores)", false, 0, cmdline::range(0, 1024)); // number of cores by default
+  p.add<int>("max-failures", '\0', "with multi threading, abandon a block when this many minkowski sums failed (0: never)", false, 0, cmdline::range(0, 1000000)); // never by default
+  p.add<double>("budget", '\0', "time budget (s) for the minkowski sum of one building, replaced by its convex hull if exceeded (0: no budget)", false, 0); // no budget by default
+  p.add<std::string>("ladder", '\0', "retry ladder for failing minkowski sums, e.g. direct,snapped,perturbed,decomposition,lod1,hull (empty: no ladder)", false, ""); // no ladder by default
+  p.add<double>("rung-budget", '\0', "time budget (s) for each rung of the ladder (0: no budget)", false, 0); // no budget by default
+  p.add<std::string>("validate", '\0', "validation level: off, sampled, full", false, Validation::get_level_string(), cmdline::oneof<std::string>("off", "sampled", "full")); // off for release, full for debug by default
 
   p.add("remesh", '\0', "activate remeshing processing (warning: time consuming)");
   p.add("multi", '\0', "activate multi threading process"); // boolean flags
+  p.add("prescreen", '\0', "screen buildings with an inexact kernel before building nefs"); // boolean flags
+  p.add("dedup", '\0', "build and expand identical (translated) buildings only once"); // boolean flags
+  p.add("schedule", '\0', "order minkowski tasks longest-first by a cost model (calibrated with cost_records.txt)"); // boolean flags
+  p.add("pipeline", '\0', "stream each building through parse, build, minkowski sum and union in the thread pool (implies --multi)"); // boolean flags
+  p.add("isolate", '\0', "run each minkowski sum in a worker process, a crash only loses that building (Linux / macOS)"); // boolean flags
+  p.add("deterministic", '\0', "canonical vertex / face / shell order and a fixed union order, identical output for any thread count"); // boolean flags
+  p.add("skip-isolated", '\0', "do not expand buildings without any neighbour within the minkowski value"); // boolean flags
   p.add("json", '\0', "output as .json file format"); // boolean flags
   p.add("off", '\0', "output as .off file format"); // boolean flags
   p.add("all", '\0', "adjacency file contains all adjacent blocks"); // boolean flags
@@ -81,17 +104,91 @@ int main(int argc, char* argv[])
   double target_edge_length = p.get<double>("target edge length");
   bool enable_remeshing = p.exist("remesh");
   bool enable_multi_threading = p.exist("multi");
+  MT::threads = (std::size_t)p.get<int>("threads");
+  MT::max_failures = (std::size_t)p.get<int>("max-failures");
   bool all_adjacency_tag = p.exist("all");
+  bool enable_dedup = p.exist("dedup");
+  bool enable_skip_isolated = p.exist("skip-isolated");
+  Cost::enabled = p.exist("schedule");
+  std::string engine_string = p.get<std::string>("engine");
+  if (engine_string == "decomposition")NefProcessing::engine = Minkowski_engine::DECOMPOSITION;
+  bool enable_extrusion = (engine_string == "extrusion");
+  if (enable_extrusion && std::abs(lod - 2.2) < epsilon) {
+	std::cout << "extrusion engine is only for lod 1.2 / 1.3, cgal engine is used instead\n";
+	enable_extrusion = false;
+	engine_string = "cgal";
+  }
+  std::string merge_string = p.get<std::string>("merge");
+  bool enable_snap_merge = (merge_string == "snap");
+  bool enable_bridge_merge = (merge_string == "bridge");
+  if ((enable_snap_merge || enable_bridge_merge) && enable_dedup) {
+	std::cout << "deduplication is not available for the " << merge_string << " merge mode, deduplication is disabled\n";
+	enable_dedup = false;
+  }
+  if (enable_skip_isolated && (enable_dedup || enable_snap_merge || enable_bridge_merge)) {
+	std::cout << "skipping isolated buildings is only available for the minkowski merge mode without deduplication, it is disabled\n";
+	enable_skip_isolated = false;
+  }
+  bool enable_pipeline = p.exist("pipeline");
+  if (enable_pipeline && (enable_dedup || enable_snap_merge || enable_bridge_merge || enable_skip_isolated || Cost::enabled)) {
+	std::cout << "the pipeline needs the whole block for deduplication, snap / bridge merge, skipping isolated buildings and scheduling, it is disabled\n";
+	enable_pipeline = false;
+  }
+  if (enable_pipeline && !enable_multi_threading) {
+	std::cout << "the pipeline runs in the thread pool, multi threading is enabled\n";
+	enable_multi_threading = true;
+  }
+  bool enable_voxel = (engine_string == "voxel");
+  double voxel_size = p.get<double>("voxel");
+  if (!Ladder::parse(p.get<std::string>("ladder"))) {
+	std::cerr << p.usage();
+	return 1;
+  }
+  Budget::seconds = p.get<double>("budget");
+  Budget::isolate = p.exist("isolate");
+#ifndef GEOCFD_KILLABLE_HELPER
+  if (Budget::isolate) {
+	std::cout << "worker processes need fork() (Linux / macOS), they are disabled\n";
+	Budget::isolate = false;
+  }
+#endif
+  Ladder::time_budget = p.get<double>("rung-budget");
+  if (Ladder::enabled() && Ladder::time_budget <= 0)Ladder::time_budget = Budget::seconds; // the ladder uses the budget for each rung
+  Validation::level = Validation::get_level(p.get<std::string>("validate"));
+  NefProcessing::deterministic = p.exist("deterministic");
+  if (NefProcessing::deterministic && (Budget::seconds > 0 || Ladder::time_budget > 0)) {
+	std::cout << "the time budgets depend on the machine load, the replaced buildings (and the output) may differ between runs\n";
+  }
+  if (NefProcessing::deterministic && MT::max_failures != 0) {
+	std::cout << "the tasks cancelled after too many failures depend on the timing and the number of threads, --max-failures is disabled for deterministic output\n";
+	MT::max_failures = 0;
+  }
+
+  // options for building nefs
+  Build_options build_options;
+  build_options.prescreen = p.exist("prescreen");
+  build_options.snap_grid = p.get<double>("snap");
 
   // pre-defined parameters
   //std::string srcFile = "D:\\SP\\geoCFD\\data\\3dbag_v210908_fd2cee53_5907.json";
   //std::string path = "D:\\SP\\geoCFD\\data";
   std::string delimiter = "\\";
 
+  // ladder records of a previous run
+  if (Ladder::enabled()) {
+	Ladder::read_records(path + delimiter + "ladder_records.txt");
+  }
+
+  // timings of previous runs, for calibrating the cost model
+  if (Cost::enabled) {
+	Cost::read_records(path + delimiter + "cost_records.txt");
+  }
+
   // optional parameters
   unsigned int adjacency_size = 50; /* number of adjacent buildings in one block */
   unsigned int adjacencies_size = 100; /* number of adjacencies in one tile */
   bool print_building_info = false; /* whether to print the building info to the console */
+  double dedup_tolerance = build_options.snap_grid > 0 ? build_options.snap_grid : 1e-6; /* tolerance for comparing the shapes, the snap grid if snapping */
 
   // output files
   bool OUTPUT_JSON = p.exist("json");
@@ -118,6 +215,19 @@ int main(int argc, char* argv[])
 
 
 
+  /* worker processes for the time budgets and the isolation, forked before any thread is started (see Workers) ----------*/
+  if (Budget::seconds > 0 || Budget::isolate || Ladder::time_budget > 0) {
+	if (!Workers::start(enable_multi_threading ? MT::threads : 1) && Budget::isolate) {
+	  std::cout << "the worker processes can not be started, the minkowski sums are not isolated\n";
+	}
+  }
+  /* ----------------------------------------------------------------------------------------------------------------------*/
+
+
+
+
+
+
   /* print the parameters -------------------------------------------------------------------------------------------------*/
   std::string emt_string = enable_multi_threading ? "true" : "false";
   std::cout << '\n';
@@ -127,9 +237,26 @@ int main(int argc, char* argv[])
   std::cout << "=> all adjacency tag\t\t " << (all_adjacency_tag ? "true" : "false") << '\n';
   std::cout << "=> lod level\t\t\t " << lod << '\n';
   std::cout << "=> minkowksi parameter\t\t " << minkowski_param << '\n';
+  std::cout << "=> minkowski engine\t\t " << engine_string << '\n';
+  if (enable_voxel)std::cout << "=> voxel size\t\t\t " << voxel_size << '\n';
+  std::cout << "=> merge mode\t\t\t " << merge_string << '\n';
   std::cout << "=> enable remeshing\t\t " << (enable_remeshing ? "true" : "false") << '\n';
   std::cout << "=> target edge length\t\t " << target_edge_length << '\n';
   std::cout << "=> enable multi threading\t " << emt_string << '\n';
+  if (enable_multi_threading)std::cout << "=> threads\t\t\t " << MT::get_pool().size() << '\n';
+  if (enable_multi_threading)std::cout << "=> max failures per block\t " << MT::max_failures << '\n';
+  std::cout << "=> enable pre-screen\t\t " << (build_options.prescreen ? "true" : "false") << '\n';
+  std::cout << "=> snap grid\t\t\t " << build_options.snap_grid << '\n';
+  std::cout << "=> enable deduplication\t\t " << (enable_dedup ? "true" : "false") << '\n';
+  std::cout << "=> time budget (s)\t\t " << Budget::seconds << '\n';
+  std::cout << "=> isolated worker processes\t " << (Budget::isolate ? "true" : "false") << '\n';
+  std::cout << "=> retry ladder\t\t\t " << (Ladder::enabled() ? p.get<std::string>("ladder") : "none") << '\n';
+  if (Ladder::enabled())std::cout << "=> rung budget (s)\t\t " << Ladder::time_budget << '\n';
+  std::cout << "=> cost model scheduling\t " << (Cost::enabled ? "true" : "false") << '\n';
+  std::cout << "=> skip isolated buildings\t " << (enable_skip_isolated ? "true" : "false") << '\n';
+  std::cout << "=> enable pipeline\t\t " << (enable_pipeline ? "true" : "false") << '\n';
+  std::cout << "=> deterministic output\t\t " << (NefProcessing::deterministic ? "true" : "false") << '\n';
+  std::cout << "=> validation level\t\t " << Validation::get_level_string() << '\n';
   std::cout << "=> output file folder\t\t " << path << '\n';
   std::cout << "=> output file format\t\t " << output_format << '\n';
   std::cout << '\n';
@@ -175,6 +302,117 @@ int main(int argc, char* argv[])
 
 
 
+  /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+  * engines without nef polyhedra, for all adjacency mode all blocks are processed together (the same as the union of all blocks)
+  * if enable_extrusion is true (lod 1.2 / 1.3), the expansion and the union are done in 2D (see Extrusion.hpp)
+  * if any building is not 2.5D, the normal process (with nef polyhedra) below is used
+  * if enable_voxel is true, the buildings are voxelized and closed with the minkowski value (see Voxel.hpp)
+  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+
+
+
+  /* 2.5D extrusion / voxel ----------------------------------------------------------------------------------------------*/
+  if (enable_extrusion || enable_voxel) {
+
+	// get ids of adjacent buildings, all blocks are put together
+	std::vector<std::vector<std::string>> adjacencies;
+	if (all_adjacency_tag) {
+	  FileIO::read_all_adjacencies_from_txt(adjacencyFile, adjacencies);
+	}
+	else {
+	  adjacencies.emplace_back();
+	  FileIO::read_adjacency_from_txt(adjacencyFile, adjacencies.back());
+	}
+
+	/* begin counting */
+	Timer timer; // count the run time
+
+	Shell_explorer shell; // the result
+	bool done = false;
+
+	if (enable_extrusion) {
+
+	  // get the prisms of all buildings
+	  std::vector<Prism> prisms;
+	  bool all_prisms = true;
+	  for (const auto& adjacency : adjacencies) {
+		for (const auto& building_name : adjacency) {
+		  JsonHandler jhandle;
+		  jhandle.read_certain_building(j, building_name, lod, datum); // read in the building
+		  if (!Extrusion::get_prisms(jhandle, prisms, build_options)) {
+			std::cout << "building " << building_name << " is not 2.5D, cgal engine is used instead\n";
+			all_prisms = false;
+			break;
+		  }
+		}
+		if (!all_prisms)break;
+	  }
+
+	  // expand and union in 2D, then extrude
+	  if (all_prisms) {
+		done = Extrusion::expand_and_union(prisms, minkowski_param, shell);
+		if (!done)std::cout << "the extrusion failed, cgal engine is used instead\n";
+	  }
+	}
+	else {
+
+	  // voxelize all buildings, close the gaps and extract the surface
+	  Voxel voxel(voxel_size);
+	  for (const auto& adjacency : adjacencies) {
+		for (const auto& building_name : adjacency) {
+		  JsonHandler jhandle;
+		  jhandle.read_certain_building(j, building_name, lod, datum); // read in the building
+		  voxel.add(jhandle);
+		}
+	  }
+	  std::cout << "there are " << voxel.number_of_voxels() << " voxels in total" << '\n';
+	  voxel.close(minkowski_param);
+	  voxel.extract(shell);
+	  done = true;
+	}
+
+	if (done) {
+
+	  // get lod string
+	  std::string lod_string;
+	  if (std::abs(lod - 1.2) < epsilon)lod_string = "1.2";
+	  if (std::abs(lod - 1.3) < epsilon)lod_string = "1.3";
+	  if (std::abs(lod - 2.2) < epsilon)lod_string = "2.2";
+
+	  // get minkowski param string
+	  std::string minkowski_string = std::to_string(minkowski_param);
+
+	  // write file
+	  if (OUTPUT_JSON) {
+		std::string writeFilename = engine_string + "_lod=" + lod_string + "_" + "m=" + minkowski_string + ".json";
+		std::cout << "writing the result to cityjson file...\n";
+		FileIO::write_JSON(path + delimiter + writeFilename, shell, lod);
+	  }
+	  if (OUTPUT_OFF) {
+		std::string writeFilename = engine_string + "_lod=" + lod_string + "_" + "m=" + minkowski_string + ".off";
+		std::cout << "writing the result to OFF file...\n";
+		if (!FileIO::write_OFF(path + delimiter + writeFilename, shell)) {
+		  std::cerr << "can not write .off file, please check" << '\n';
+		  return 1;
+		}
+	  }
+	  if (enable_remeshing) {
+		std::cout << "remeshing is not available for the " << engine_string << " engine\n";
+	  }
+
+	  return EXIT_SUCCESS;
+	}
+
+  } // end if: enable_extrusion || enable_voxel
+  /* ----------------------------------------------------------------------------------------------------------------------*/
+
+
+
+
+
+
   /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
   * if all_adjacency_tag is marked as false, that means the input adjacency file only contains one block
   * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
@@ -195,51 +433,96 @@ int main(int argc, char* argv[])
 	std::vector<JsonHandler> jhandles;
 	jhandles.reserve(adjacency_size); // use reserve() to avoid extra copies
 
-	// get jhandles, one jhandle for each building
-	if (print_building_info)std::cout << "------------------------ building(part) info ------------------------\n";
-	for (const auto& building_name : adjacency) // get each building
-	{
-	  JsonHandler jhandle;
-	  jhandle.read_certain_building(j, building_name, lod, datum); // read in the building
-	  jhandles.emplace_back(jhandle); // add to the jhandlers vector
+	if (!enable_pipeline) { // the pipeline parses the buildings itself
+	  // get jhandles, one jhandle for each building
+	  if (print_building_info)std::cout << "------------------------ building(part) info ------------------------\n";
+	  for (const auto& building_name : adjacency) // get each building
+	  {
+		JsonHandler jhandle;
+		jhandle.read_certain_building(j, building_name, lod, datum); // read in the building
+		jhandles.emplace_back(jhandle); // add to the jhandlers vector
 
-	  if (print_building_info) {
-		jhandle.message();
+		if (print_building_info) {
+		  jhandle.message();
+		}
 	  }
+	  if (print_building_info)std::cout << "---------------------------------------------------------------------\n";
 	}
-	if (print_building_info)std::cout << "---------------------------------------------------------------------\n";
 
 	/* begin counting */
 	Timer timer; // count the run time
 
-	/* build the nef and stored in nefs vector */
-	std::vector<Nef_polyhedron> nefs; // hold the nefs
-	nefs.reserve(adjacency_size); // avoid reallocation, use reserve() whenever possible
-	for (const auto& jhdl : jhandles) {
-	  Build::build_nef_polyhedron(jhdl, nefs); // triangulation tag can be passed as parameters, set to true by default
-	}std::cout << "there are " << nefs.size() << " " << "nef polyhedra in total" << '\n';
-
-	/* perform minkowski sum operation and store expanded nefs in nefs_expanded vector */
-	std::vector<Nef_polyhedron> expanded_nefs;
-	expanded_nefs.reserve(adjacency_size); // avoid reallocation, use reserve() whenever possible
-
-	/* performing minkowski operations -------------------------------------------------------------------------*/
-	std::cout << "performing minkowski sum ... " << '\n';
-	if (enable_multi_threading) {
-	  std::cout << "multi threading is enabled" << '\n';
-	  MT::expand_nefs_async(nefs, expanded_nefs, minkowski_param);
+	Nef_polyhedron big_nef;
+	if (enable_pipeline) {
+	  Pipeline pipeline(0, NefProcessing::deterministic, print_building_info); // parse -> build -> expand -> union, each building on its own
+	  if (!pipeline.run(j, adjacency, lod, datum, build_options, minkowski_param, big_nef)) {
+		std::cout << "too many failed buildings, the block is abandoned, the result is incomplete" << '\n';
+	  }
 	}
 	else {
-	  MT::expand_nefs(nefs, expanded_nefs, minkowski_param);
-	}
-	std::cout << "done" << '\n';
-	/* building nefs and performing minkowski operations -------------------------------------------------------------------------*/
+	  /* build the nef and stored in nefs vector */
+	  std::vector<Nef_polyhedron> nefs; // hold the nefs
+	  nefs.reserve(adjacency_size); // avoid reallocation, use reserve() whenever possible
+	  Dedup dedup(dedup_tolerance); // hold the unique shapes if deduplication is enabled
+	  if (enable_dedup) {
+		dedup.build(jhandles, build_options, enable_multi_threading); // only one nef for each unique shape
+	  }
+	  else if (enable_snap_merge) {
+		Snap snap(minkowski_param); // snap the buildings together, the minkowski value is used as the tolerance
+		snap.build(jhandles, build_options, nefs);
+	  }
+	  else if (enable_bridge_merge) {
+		Bridge bridge(minkowski_param); // originals and bridges between near-contact faces
+		bridge.build(jhandles, build_options, nefs);
+	  }
+	  else if (enable_multi_threading) {
+		MT::build_nefs_async(jhandles, nefs, build_options); // one task for each building
+		std::cout << "there are " << nefs.size() << " " << "nef polyhedra in total" << '\n';
+	  }
+	  else {
+		for (const auto& jhdl : jhandles) {
+		  Build::build_nef_polyhedron(jhdl, nefs, build_options); // triangulation tag can be set in build_options, set to true by default
+		}std::cout << "there are " << nefs.size() << " " << "nef polyhedra in total" << '\n';
+	  }
 
-	// merging nefs into one big nef
-	std::cout << "building big nef ..." << '\n';
-	Nef_polyhedron big_nef;
-	for (auto& nef : expanded_nefs) {
-	  big_nef += nef;
+	  /* perform minkowski sum operation and store expanded nefs in nefs_expanded vector */
+	  std::vector<Nef_polyhedron> expanded_nefs;
+	  expanded_nefs.reserve(adjacency_size); // avoid reallocation, use reserve() whenever possible
+
+	  /* performing minkowski operations -------------------------------------------------------------------------*/
+	  std::cout << "performing minkowski sum ... " << '\n';
+	  if (enable_skip_isolated) {
+		std::size_t isolated = NefProcessing::separate_isolated(nefs, expanded_nefs, minkowski_param); // isolated nefs go to expanded_nefs unchanged
+		std::cout << isolated << " isolated nef polyhedra are not expanded" << '\n';
+	  }
+	  if (enable_snap_merge || enable_bridge_merge) {
+		std::cout << "skipped in " << merge_string << " merge mode" << '\n';
+		expanded_nefs.swap(nefs); // the snapped nefs / the originals and bridges are unioned directly
+	  }
+	  else if (enable_dedup) {
+		if (!dedup.expand(expanded_nefs, minkowski_param, enable_multi_threading)) { // expand unique shapes and translate them into place
+		  std::cout << "too many failed minkowski sums, the block is abandoned, the result is incomplete" << '\n';
+		}
+	  }
+	  else if (enable_multi_threading) {
+		std::cout << "multi threading is enabled" << '\n';
+		if (!MT::expand_nefs_async(nefs, expanded_nefs, minkowski_param)) {
+		  std::cout << "too many failed minkowski sums, the block is abandoned, the result is incomplete" << '\n';
+		}
+	  }
+	  else {
+		MT::expand_nefs(nefs, expanded_nefs, minkowski_param);
+	  }
+	  std::cout << "done" << '\n';
+	  /* building nefs and performing minkowski operations -------------------------------------------------------------------------*/
+
+	  // merging nefs into one big nef, balanced pairwise union (in parallel with multi threading)
+	  // nearby nefs are merged first (see NefProcessing::spatial_order())
+	  std::cout << "building big nef ..." << '\n';
+	  NefProcessing::spatial_order(expanded_nefs);
+	  big_nef = enable_multi_threading ?
+		MT::union_nefs_async(expanded_nefs) : NefProcessing::balanced_union(expanded_nefs);
+	  if (enable_snap_merge)big_nef = big_nef.regularization(); // remove the shared walls from the interior
 	}
 	std::cout << "done" << '\n';
 
@@ -308,6 +591,26 @@ int main(int argc, char* argv[])
 
 	}
 
+	// validation report
+	if (Validation::level != Validation::Level::OFF) {
+	  Validation::write_report(path + delimiter + "validation_report.txt");
+	}
+
+	// ladder records, the next run starts at the recorded rungs
+	if (Ladder::enabled()) {
+	  Ladder::write_records(path + delimiter + "ladder_records.txt");
+	}
+
+	// timings, the next run calibrates the cost model with them
+	if (Cost::enabled) {
+	  Cost::write_records(path + delimiter + "cost_records.txt");
+	}
+
+	// buildings (and ladder rungs) replaced because of the time budget or a crash
+	if (!Budget::replacements.empty()) {
+	  Budget::write_log(path + delimiter + "budget_log.txt");
+	}
+
 	return EXIT_SUCCESS;
 
   } // end if: all_adjacency_tag
@@ -328,9 +631,6 @@ int main(int argc, char* argv[])
 
   if (all_adjacency_tag) {
 
-	enable_multi_threading = false;
-	std::cout << "multi threading process should not be enabled with all adjacencies\n";
-
 	// declarations for convenient use
 	using std::vector;
 	using std::string;
@@ -342,118 +642,169 @@ int main(int argc, char* argv[])
 
 
 	// for each adjacency in adjacencies, we perform akin operations as above
-	// some optimization can be done (e.g. via lambda function to avoid code repeatness) if having time
+	// the blocks are independent, each of them builds, expands and unions its own nefs in process_adjacency()
+	// with multi threading, the blocks are processed concurrently in the thread pool (see MT::get_pool())
 
 
 	// for mark the output files
 	unsigned int num_off = 1;
 	unsigned int num_json = 1;
 
-	// for tracking which adjacency is currently being processed
-	unsigned int num_adjacency = 1;
-
 	// for storing constructed big_nefs
-	vector<Nef_polyhedron> big_nefs;
-
-	// needed vectors
-	// after the usage for each adjacency, call clear() method for next use
-	// avoid repeated creation whenever possible
-	vector<JsonHandler> jhandles;  // hold jhandles, one jhandle for one building
-	vector<Nef_polyhedron> nefs; // hold the nefs
-	vector<Nef_polyhedron> expanded_nefs; // hold expanded nefs
-	vector<Shell_explorer> shell_explorers; // hold shells for big nef
+	// one slot for each adjacency, each block only writes its own slot, thus no lock is needed
+	vector<Nef_polyhedron> big_nefs(adjacencies.size());
 
-	jhandles.reserve(adjacency_size); // avoid reallocation, use reserve() whenever possible
-	nefs.reserve(adjacency_size);
-	expanded_nefs.reserve(adjacency_size);
+	// process one adjacency, the 0-based index is the slot in big_nefs
+	// with multi threading, the block task submits its building tasks (build, minkowski sum) to the same pool
+	// and unions the expanded nefs when they are done, thus a few large blocks and many small blocks both keep the cores busy
+	auto process_adjacency = [&](std::size_t index) {
 
-	// process each adjacency
-	for (const auto& adjacency : adjacencies) {
+	  // needed vectors, local to this block
+	  vector<JsonHandler> jhandles;  // hold jhandles, one jhandle for one building
+	  vector<Nef_polyhedron> nefs; // hold the nefs
+	  vector<Nef_polyhedron> expanded_nefs; // hold expanded nefs
+
+	  const vector<string>& adjacency = adjacencies[index];
+	  jhandles.reserve(adjacency.size()); // avoid reallocation, use reserve() whenever possible
+	  nefs.reserve(adjacency.size());
+	  expanded_nefs.reserve(adjacency.size());
 
 	  // track the adjacency - 1-based index, e.g. adjacency 1, adjacency 2, ...
 	  std::cout << '\n';
-	  std::cout << "processing adjacency " << num_adjacency << " ...\n";
+	  std::cout << "processing adjacency " << index + 1 << " ...\n";
 
 
 	  // create big nef
 	  // ------------------------------------------------------------------------------------------------------------------
-	  // read buildings, get jhandles, one jhandle for each building
-	  if (print_building_info)std::cout << "------------------------ building(part) info ------------------------\n";
-	  for (const auto& building_name : adjacency) // get each building
-	  {
-		JsonHandler jhandle;
-		jhandle.read_certain_building(j, building_name, lod, datum); // read in the building
-		jhandles.emplace_back(jhandle); // add to the jhandlers vector
-
-		if (print_building_info) {
-		  jhandle.message();
+	  if (!enable_pipeline) { // the pipeline parses the buildings itself
+		// read buildings, get jhandles, one jhandle for each building
+		if (print_building_info)std::cout << "------------------------ building(part) info ------------------------\n";
+		for (const auto& building_name : adjacency) // get each building
+		{
+		  JsonHandler jhandle;
+		  jhandle.read_certain_building(j, building_name, lod, datum); // read in the building
+		  jhandles.emplace_back(jhandle); // add to the jhandlers vector
+
+		  if (print_building_info) {
+			jhandle.message();
+		  }
 		}
+		if (print_building_info)std::cout << "---------------------------------------------------------------------\n";
 	  }
-	  if (print_building_info)std::cout << "---------------------------------------------------------------------\n";
 
 
 	  /* begin counting */
 	  Timer timer; // count the run time
 
 
-	  /* build the nef and stored in nefs vector */
-	  for (const auto& jhdl : jhandles) {
-		Build::build_nef_polyhedron(jhdl, nefs); // triangulation tag can be passed as parameters, set to true by default
-	  }std::cout << "there are " << nefs.size() << " " << "nef polyhedra in total" << '\n';
-
-
-	  /* perform minkowski sum operation and store expanded nefs in nefs_expanded vector */
-	  /* performing minkowski operations -------------------------------------------------------------------------*/
-	  std::cout << "performing minkowski sum ... " << '\n';
-	  if (enable_multi_threading) {
-		std::cout << "multi threading is enabled" << '\n';
-		MT::expand_nefs_async(nefs, expanded_nefs, minkowski_param);
+	  Nef_polyhedron big_nef;
+	  if (enable_pipeline) {
+		Pipeline pipeline(0, NefProcessing::deterministic, print_building_info); // parse -> build -> expand -> union, each building on its own
+		if (!pipeline.run(j, adjacency, lod, datum, build_options, minkowski_param, big_nef)) {
+		  std::cout << "adjacency " << index + 1 << " is abandoned (too many failed buildings)\n";
+		  return; // the slot of the block stays empty
+		}
 	  }
 	  else {
-		MT::expand_nefs(nefs, expanded_nefs, minkowski_param);
-	  }
-	  std::cout << "done" << '\n';
-	  /* building nefs and performing minkowski operations -------------------------------------------------------------------------*/
-
+		/* build the nef and stored in nefs vector */
+		Dedup dedup(dedup_tolerance); // hold the unique shapes of this adjacency if deduplication is enabled
+		if (enable_dedup) {
+		  dedup.build(jhandles, build_options, enable_multi_threading); // only one nef for each unique shape
+		}
+		else if (enable_snap_merge) {
+		  Snap snap(minkowski_param); // snap the buildings together, the minkowski value is used as the tolerance
+		  snap.build(jhandles, build_options, nefs);
+		}
+		else if (enable_bridge_merge) {
+		  Bridge bridge(minkowski_param); // originals and bridges between near-contact faces
+		  bridge.build(jhandles, build_options, nefs);
+		}
+		else if (enable_multi_threading) {
+		  MT::build_nefs_async(jhandles, nefs, build_options); // building tasks of this block
+		  std::cout << "there are " << nefs.size() << " " << "nef polyhedra in total" << '\n';
+		}
+		else {
+		  for (const auto& jhdl : jhandles) {
+			Build::build_nef_polyhedron(jhdl, nefs, build_options); // triangulation tag can be set in build_options, set to true by default
+		  }std::cout << "there are " << nefs.size() << " " << "nef polyhedra in total" << '\n';
+		}
 
-	  // merging nefs into one big nef
-	  std::cout << "building big nef ..." << '\n';
-	  Nef_polyhedron big_nef;
-	  for (auto& nef : expanded_nefs) {
-		big_nef += nef;
-	  }
-	  std::cout << "done" << '\n';
-	  big_nefs.emplace_back(big_nef);
-	  // ------------------------------------------------------------------------------------------------------------------
 
+		/* perform minkowski sum operation and store expanded nefs in nefs_expanded vector */
+		/* performing minkowski operations -------------------------------------------------------------------------*/
+		std::cout << "performing minkowski sum ... " << '\n';
+		if (enable_skip_isolated) {
+		  std::size_t isolated = NefProcessing::separate_isolated(nefs, expanded_nefs, minkowski_param); // isolated nefs go to expanded_nefs unchanged
+		  std::cout << isolated << " isolated nef polyhedra are not expanded" << '\n';
+		}
+		if (enable_snap_merge || enable_bridge_merge) {
+		  std::cout << "skipped in " << merge_string << " merge mode" << '\n';
+		  expanded_nefs.swap(nefs); // the snapped nefs / the originals and bridges are unioned directly
+		}
+		else if (enable_dedup) {
+		  if (!dedup.expand(expanded_nefs, minkowski_param, enable_multi_threading)) { // expand unique shapes and translate them into place
+			std::cout << "adjacency " << index + 1 << " is abandoned (too many failed minkowski sums)\n";
+			return; // the slot of the block stays empty
+		  }
+		}
+		else if (enable_multi_threading) {
+		  if (!MT::expand_nefs_async(nefs, expanded_nefs, minkowski_param)) { // building tasks of this block, in the same pool
+			std::cout << "adjacency " << index + 1 << " is abandoned (too many failed minkowski sums)\n";
+			return; // the slot of the block stays empty
+		  }
+		}
+		else {
+		  MT::expand_nefs(nefs, expanded_nefs, minkowski_param);
+		}
+		std::cout << "done" << '\n';
+		/* building nefs and performing minkowski operations -------------------------------------------------------------------------*/
 
 
+		// merging nefs into one big nef, balanced pairwise union (union tasks of this block with multi threading)
+		// nearby nefs are merged first (see NefProcessing::spatial_order())
+		std::cout << "building big nef ..." << '\n';
+		NefProcessing::spatial_order(expanded_nefs);
+		big_nef = enable_multi_threading ?
+		  MT::union_nefs_async(expanded_nefs) : NefProcessing::balanced_union(expanded_nefs);
+		if (enable_snap_merge)big_nef = big_nef.regularization(); // remove the shared walls from the interior
+	  }
+	  std::cout << "done" << '\n';
+	  big_nefs[index] = big_nef;
 	  // ------------------------------------------------------------------------------------------------------------------
 
 
-
-	  std::cout << "adjacency " << num_adjacency << " done\n";
+	  std::cout << "adjacency " << index + 1 << " done\n";
 	  std::cout << '\n';
-	  ++num_adjacency;
+	};
 
 
+	// process each adjacency
+	if (enable_multi_threading) {
+	  std::cout << "multi threading is enabled, the adjacencies are processed in parallel" << '\n';
+	  ThreadPool& pool = MT::get_pool();
+	  vector<std::future<void>> block_futures;
+	  block_futures.reserve(adjacencies.size());
+	  for (std::size_t index = 0; index != adjacencies.size(); ++index) {
+		block_futures.emplace_back(pool.submit([&process_adjacency, index]() { process_adjacency(index); }));
+	  }
+	  pool.wait_all(block_futures);
+	}
+	else {
+	  for (std::size_t index = 0; index != adjacencies.size(); ++index) {
+		process_adjacency(index);
+	  }
+	}
 
-	  // vector cleaning for next use -------------------------------------------------------------------------------------
-	  jhandles.clear();  // hold jhandles, one jhandle for one building
-	  nefs.clear(); // hold the nefs
-	  expanded_nefs.clear(); // hold expanded nefs
-	  shell_explorers.clear(); // hold shells for big nef
-	  // ------------------------------------------------------------------------------------------------------------------
-	} // end for: adjacencies
+	vector<Shell_explorer> shell_explorers; // hold shells for big nef
 
 
 
 	// --------------------------------------------------------------------------------------------------------------------
 	std::cout << "adding all big nefs ...\n";
-	Nef_polyhedron big_nef_all;
-	for (auto& bignef : big_nefs) {
-	  big_nef_all += bignef;
-	}std::cout<< "done\n";
+	NefProcessing::spatial_order(big_nefs); // nearby blocks are merged first
+	Nef_polyhedron big_nef_all = enable_multi_threading ?
+	  MT::union_nefs_async(big_nefs) : NefProcessing::balanced_union(big_nefs);
+	std::cout<< "done\n";
 
 
 	// extract geometries and possible post-processing
@@ -530,6 +881,26 @@ int main(int argc, char* argv[])
 	}
 
 
+	// validation report
+	if (Validation::level != Validation::Level::OFF) {
+	  Validation::write_report(path + delimiter + "validation_report.txt");
+	}
+
+	// ladder records, the next run starts at the recorded rungs
+	if (Ladder::enabled()) {
+	  Ladder::write_records(path + delimiter + "ladder_records.txt");
+	}
+
+	// timings, the next run calibrates the cost model with them
+	if (Cost::enabled) {
+	  Cost::write_records(path + delimiter + "cost_records.txt");
+	}
+
+	// buildings (and ladder rungs) replaced because of the time budget or a crash
+	if (!Budget::replacements.empty()) {
+	  Budget::write_log(path + delimiter + "budget_log.txt");
+	}
+
 	// after processing all adjacencies, exit
 	return EXIT_SUCCESS;
 